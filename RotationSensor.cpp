@@ -10,6 +10,69 @@ Support for an interrupt-driven rotation sensor.
 
 #include "RotationSensor.h"
 
+#if defined(__AVR__)
+#include <wiring_private.h>
+#endif
+
+#if ROTATIONSENSOR_LOW_POWER
+#include <avr/sleep.h>
+#endif
+
+#if ROTATIONSENSOR_PCNT_PIN >= 0
+#include <driver/pcnt.h>
+#endif
+
+// The ARM and ESP32 cores can attach an interrupt to (nearly) every pin, and
+// their interrupt numbers are the pin numbers
+#if !defined(EXTERNAL_NUM_INTERRUPTS) && defined(NUM_DIGITAL_PINS) && !defined(__AVR__)
+#define EXTERNAL_NUM_INTERRUPTS NUM_DIGITAL_PINS
+#elif !defined(EXTERNAL_NUM_INTERRUPTS)
+#define EXTERNAL_NUM_INTERRUPTS 2
+#endif
+
+#if ROTATIONSENSOR_DIRECT_ISR && !(defined(__AVR_ATmega48__)  || defined(__AVR_ATmega48P__)  || \
+                                   defined(__AVR_ATmega88__)  || defined(__AVR_ATmega88P__)  || \
+                                   defined(__AVR_ATmega168__) || defined(__AVR_ATmega168P__) || \
+                                   defined(__AVR_ATmega328__) || defined(__AVR_ATmega328P__))
+#error "ROTATIONSENSOR_DIRECT_ISR is only supported on the ATmega48/88/168/328"
+#endif
+
+#if ROTATIONSENSOR_USE_ICP1 && (ROTATIONSENSOR_TIMEBASE != ROTATIONSENSOR_TIMEBASE_TIMER1)
+#error "ROTATIONSENSOR_USE_ICP1 requires ROTATIONSENSOR_TIMEBASE_TIMER1"
+#endif
+
+#if ROTATIONSENSOR_USE_T1_COUNTER && (ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER1 || ROTATIONSENSOR_USE_ICP1)
+#error "ROTATIONSENSOR_USE_T1_COUNTER cannot be combined with ROTATIONSENSOR_TIMEBASE_TIMER1 or ROTATIONSENSOR_USE_ICP1"
+#endif
+
+#if ROTATIONSENSOR_BURST_CAPTURE && !ROTATIONSENSOR_USE_ICP1
+#error "ROTATIONSENSOR_BURST_CAPTURE requires ROTATIONSENSOR_USE_ICP1"
+#endif
+
+#if ROTATIONSENSOR_PCNT_PIN >= 0 && (!defined(ARDUINO_ARCH_ESP32) || ROTATIONSENSOR_USE_T1_COUNTER)
+#error "ROTATIONSENSOR_PCNT_PIN requires an ESP32 and cannot be combined with ROTATIONSENSOR_USE_T1_COUNTER"
+#endif
+
+#if ROTATIONSENSOR_COMPACT && ROTATIONSENSOR_ACCELERATION
+#error "ROTATIONSENSOR_ACCELERATION cannot be combined with ROTATIONSENSOR_COMPACT"
+#endif
+
+#if ROTATIONSENSOR_LOW_POWER && (!defined(__AVR__) || !ROTATIONSENSOR_USE_PCINT)
+#error "ROTATIONSENSOR_LOW_POWER requires an AVR MCU and ROTATIONSENSOR_USE_PCINT"
+#endif
+
+#if ROTATIONSENSOR_LOW_POWER && (ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER1 || ROTATIONSENSOR_USE_T1_COUNTER)
+#error "ROTATIONSENSOR_LOW_POWER cannot be combined with Timer1, which stops while the MCU sleeps"
+#endif
+
+#if defined(__AVR_ATmega32U4__)
+static const uint8_t ICP1_PIN = 4;
+static const uint8_t T1_PIN   = 12;
+#else
+static const uint8_t ICP1_PIN = 8;
+static const uint8_t T1_PIN   = 5;
+#endif
+
 
 
 /******************************************************************************
@@ -20,63 +83,309 @@ Support for an interrupt-driven rotation sensor.
  be static and volatile.
 ******************************************************************************/
 
-#if DEBUG
-static const int debugStackSize = 32;
-static volatile int debugIdx = 0;
-static volatile uint32_t debugTime[debugStackSize];
-static volatile uint32_t debugCount[debugStackSize];
+/******************************************************************************
+ Sensor table for the external interrupts, indexed by interrupt number. There
+ is one entry for each external interrupt the MCU provides.
+******************************************************************************/
+static volatile RotationSensor* pSensors[EXTERNAL_NUM_INTERRUPTS];
+
+typedef void (*RotationSensorISRFunc)();
+
+
+/*******************************************************************************
+ Quadrature decoder
+
+ In 4X mode the previous and current A/B states index a 16 entry table giving
+ the step for each transition: +1 when A leads B, -1 when B leads A, and 0 for
+ no change or for an invalid transition (both channels changed, i.e., an edge
+ was missed). In 1X and 2X mode only edges of A are seen, and the direction is
+ given by whether A and B differ just after the edge.
+*******************************************************************************/
+#if ROTATIONSENSOR_QUADRATURE
+#if defined(ARDUINO_ARCH_ESP32)
+static const int8_t DRAM_ATTR QuadratureTable[16] =
+#else
+static const int8_t QuadratureTable[16] PROGMEM =
+#endif
+{
+//  AB: 00  01  10  11      (previous AB in rows)
+         0, -1, +1,  0,     // 00
+        +1,  0,  0, -1,     // 01
+        -1,  0,  0, +1,     // 10
+         0, +1, -1,  0      // 11
+};
 #endif
 
 
-/******************************************************************************
- Forward declarations for each ISR
-******************************************************************************/
-static volatile RotationSensor* pSensors[2];
+/*******************************************************************************
+ Interrupt Service Routines (ISR)
+
+ Since there is no inherent way to distinguish which sensor is triggering the
+ interrupt, each external interrupt must have its own ISR. RotationSensorISR<N>
+ generates one ISR per interrupt number, so the table index is a compile time
+ constant that resolves to an absolute memory address in each ISR. Only the ISRs
+ actually attached by Enable() are referenced through RotationSensorISRTable,
+ which is sized to the number of external interrupts of the MCU.
+*******************************************************************************/
+template<uint8_t IRQ> void RotationSensorISR()
+{
+    auto pSensor = pSensors[IRQ];
+
+#if ROTATIONSENSOR_DIRECT_ISR
+    // The interrupt is only unmasked while a sensor is registered for it
+    pSensor->Count_ISR(RotationSensorTimebase::NowFromISR());
+#else
+    if (pSensor != NULL) pSensor->Count_ISR(RotationSensorTimebase::NowFromISR());
+#endif
+}
+
+
+template<uint8_t N> struct RotationSensorISRTable
+{
+    static RotationSensorISRFunc Get(uint8_t irq)
+    {
+        return (irq == N - 1) ? RotationSensorISR<N - 1> : RotationSensorISRTable<N - 1>::Get(irq);
+    }
+};
+
+
+template<> struct RotationSensorISRTable<0>
+{
+    static RotationSensorISRFunc Get(uint8_t) { return NULL; }
+};
+
+
+#if ROTATIONSENSOR_DIRECT_ISR
+ISR(INT0_vect) { RotationSensorISR<0>(); }
+ISR(INT1_vect) { RotationSensorISR<1>(); }
+#endif
+
+
+/*******************************************************************************
+ On ESP32 the ISRs must be in IRAM, and GCC does not place the instances of a
+ template in a section, so the external interrupts call a single ISR with the
+ sensor as argument instead of RotationSensorISR<N>. The RotationSensorT ISRs
+ are of the same kind, one per DEBOUNCE setting of Edge_ISR().
+*******************************************************************************/
+#if defined(ARDUINO_ARCH_ESP32)
+void ROTATIONSENSOR_IRAM_ATTR RotationSensor_ExternalISR(void* pSensor)
+{
+    static_cast<RotationSensor*>(pSensor)->Count_ISR(RotationSensorTimebase::NowFromISR());
+}
+
+
+void ROTATIONSENSOR_IRAM_ATTR RotationSensor_EdgeISR(void* pSensor)
+{
+    static_cast<RotationSensor*>(pSensor)->Edge_ISR<false>(RotationSensorTimebase::NowFromISR());
+}
+
+
+void ROTATIONSENSOR_IRAM_ATTR RotationSensor_DebouncedEdgeISR(void* pSensor)
+{
+    static_cast<RotationSensor*>(pSensor)->Edge_ISR<true>(RotationSensorTimebase::NowFromISR());
+}
+#endif
 
-void RotationSensor_ISR_0();
-void RotationSensor_ISR_1();
 
 DEFINE_CLASSNAME(RotationSensor);
 
+
+// Returns true if the sensor table has an entry for an interrupt number
+static inline bool UsableIRQ(int irq)
+{
+    return irq != NOT_AN_INTERRUPT && irq >= 0 && irq < EXTERNAL_NUM_INTERRUPTS;
+}
+
+// Stores a pulse interval, which saturates in the compact CountData layout
+static inline void SetInterval(RotationSensor::CountData& data, uint32_t us)
+{
+#if ROTATIONSENSOR_COMPACT
+    data.LastInterval = (us > 0xFFFF) ? 0xFFFF : (uint16_t)us;
+#else
+    data.LastInterval = us;
+#endif
+}
+
 /*******************************************************************************
  Constructor
 *******************************************************************************/
-RotationSensor::RotationSensor(int pin, int pulsesPerRev)
+RotationSensor::RotationSensor(int pin, int pulsesPerRev, uint16_t minInterval)
 {
     _state.Pin = pin;
+#if ROTATIONSENSOR_COMPACT
+    _state.PulsesPerRev = min(max(1, pulsesPerRev), 1023);
+#else
     _state.PulsesPerRev = max(1, pulsesPerRev);
-    _state.IRQ = digitalPinToInterrupt(_state.Pin);
+#endif
+    _rpmK = (60ULL * RotationSensorTimebase::TICKS_PER_SECOND) / _state.PulsesPerRev;
+
+    int irq = digitalPinToInterrupt(pin);
+
+    // The pin and interrupt fields are narrow, so a pin or interrupt that does
+    // not fit cannot be used. The sensor is then left without a backend,
+    // unless it gets a pin change interrupt below.
+    _state.IRQ = irq;
     _state.Enabled = false;
+    _state.Backend = (UsableIRQ(irq) && _state.IRQ == irq && _state.Pin == pin) ? ExternalBackend : NoBackend;
+    _state.Quadrature = 0;
+    _count = 0;
+    _seq = 0;
+    _drained = 0;
+#if ROTATIONSENSOR_ACCELERATION
+    _timeSum = 0;
+#endif
+#if ROTATIONSENSOR_RPM_CACHE
+    _latestRPM = 0;
+#endif
+#if ROTATIONSENSOR_AUTO_RANGE
+    _frequencyMode = false;
+    _gateCount = 0;
+    _gateTime = 0;
+    _gateRPM = -1;
+#endif
+#if ROTATIONSENSOR_QUADRATURE
+    _position = 0;
+    _quadState = 0;
+#endif
+#if ROTATIONSENSOR_EVENTS
+    _eventHandler = NULL;
+    _eventMask = 0;
+    _eventFlags = 0;
+    _eventState = 0;
+    _pulseEvery = 0;
+    _pulseCountdown = 0;
+    _revCountdown = _state.PulsesPerRev;
+    _thresholdTicks = 0;
+    _stallCount = 0;
+#endif
+
+    SetStallTimeout(ROTATIONSENSOR_STALL_TIMEOUT_MS);
+    SetAutoCrossover(0);
+
+#if ROTATIONSENSOR_DEBOUNCE
+    // Convert the threshold to ticks once so the ISR only needs a compare.
+    // 65535us fits in 32 bits up to a 65GHz timebase.
+    _minInterval = RotationSensorTimebase::MicrosToTicks(minInterval);
+    _rejected = 0;
+#else
+    (void)minInterval;
+#endif
+
+#if ROTATIONSENSOR_USE_ICP1
+    if (pin == ICP1_PIN)
+    {
+        _state.Backend = CaptureBackend;
+    }
+#endif
 
-    if (_state.IRQ != NOT_AN_INTERRUPT)
+#if ROTATIONSENSOR_USE_T1_COUNTER
+    if (pin == T1_PIN)
+    {
+        _state.Backend = CounterBackend;
+    }
+#endif
+
+#if ROTATIONSENSOR_PCNT_PIN >= 0
+    if (pin == ROTATIONSENSOR_PCNT_PIN)
+    {
+        _state.Backend = CounterBackend;
+    }
+#endif
+
+#if ROTATIONSENSOR_LOW_POWER
+    // The INTn edge interrupts cannot wake the MCU, but pin changes can
+    if (_state.Backend == ExternalBackend) _state.Backend = NoBackend;
+#endif
+
+#if ROTATIONSENSOR_USE_PCINT
+    if (_state.Backend == NoBackend && digitalPinToPCICR(pin) != NULL)
+    {
+        _state.Backend = PinChangeBackend;
+    }
+#endif
+
+    if (Attached())
     {
         pinMode(pin, INPUT);
     }
 }
 
 
+/*******************************************************************************
+ Constructor for a quadrature encoder
+*******************************************************************************/
+RotationSensor::RotationSensor(int pinA, int pinB, int pulsesPerRev, QuadratureMode mode)
+    : RotationSensor(pinA, max(1, pulsesPerRev) * (int)mode)
+{
+#if ROTATIONSENSOR_QUADRATURE
+    _state.Quadrature = mode;
+    _pinB = pinB;
+    _irqB = digitalPinToInterrupt(pinB);
+
+#if defined(__AVR__)
+    _inputA = portInputRegister(digitalPinToPort(pinA));
+    _inputB = portInputRegister(digitalPinToPort(pinB));
+    _maskA  = digitalPinToBitMask(pinA);
+    _maskB  = digitalPinToBitMask(pinB);
+#endif
+
+    // Both channels must be decoded from external interrupts
+    if (_state.IRQ != digitalPinToInterrupt(pinA) || !UsableIRQ(_state.IRQ) || (mode == Quadrature4X && !UsableIRQ(_irqB)))
+    {
+        _state.Backend = NoBackend;
+    }
+    else
+    {
+        _state.Backend = ExternalBackend;
+        pinMode(pinB, INPUT);
+    }
+#else
+    (void)pinB;
+    _state.Backend = NoBackend;
+#endif
+}
+
+
 /*******************************************************************************
  Resets the rotation sensor counter values to 0.
 *******************************************************************************/
 void RotationSensor::Reset()
 {
-    // Disable interrupts while resetting sensor values
-    noInterrupts();
+    // Disable interrupts while resetting sensor values. The ISR is the only
+    // writer of the pulse history while counting, so the reset must not overlap
+    // it. Clearing the count invalidates all the history entries.
+    uint16_t start = DisableInterrupts();
+    _seq += 2;
     _count = 0;
-    _lastPulseTime  = 0;
-    _prevPulseTime  = 0;
-    interrupts();
+#if ROTATIONSENSOR_ACCELERATION
+    _timeSum = 0;
+#endif
+#if ROTATIONSENSOR_RPM_CACHE
+    _latestRPM = 0;
+#endif
+#if ROTATIONSENSOR_AUTO_RANGE
+    _frequencyMode = false;
+#endif
+#if ROTATIONSENSOR_DEBOUNCE
+    _rejected = 0;
+#endif
+#if ROTATIONSENSOR_QUADRATURE
+    _position = 0;
+    _quadState = (_state.Quadrature != 0) ? ReadPins() : 0;
+#endif
+#if ROTATIONSENSOR_EVENTS
+    _eventFlags = 0;
+    _eventState = 0;
+    _pulseCountdown = _pulseEvery;
+    _revCountdown = _state.PulsesPerRev;
+    _stallCount = 0;
+#endif
+
+    if (_state.Backend == CounterBackend) AttachCounter(_state.Enabled);
 
-//#if DEBUG
-//    noInterrupts();
-//    debugIdx = 0;
-//    for (int i=0; i < debugStackSize; i++)
-//    {
-//        debugTime[i] = 0;
-//        debugCount[i] = 0;
-//    }
-//    interrupts();
-//#endif
+    _drained = 0;
+
+    EnableInterrupts(start);
 }
 
 
@@ -87,27 +396,26 @@ void RotationSensor::Reset()
 *******************************************************************************/
 void RotationSensor::Enable(bool enabled)
 {
-    if (_state.IRQ == NOT_AN_INTERRUPT)
+    if (!Attached())
     {
         Logger(_classname_, __func__, this) << F(": Invalid interrupt pin ") << _state.Pin << endl;
         return;
     }
 
-    int irq = _state.IRQ;
-
     if (enabled && !_state.Enabled)
     {
         Reset();
-        pSensors[irq] = this;
+        RotationSensorTimebase::Begin();
 
-        if (irq == 0) attachInterrupt(irq, RotationSensor_ISR_0, RISING);
-        else
-        if (irq == 1) attachInterrupt(irq, RotationSensor_ISR_1, RISING);
+        if (!Attach(true))
+        {
+            Logger(_classname_, __func__, this) << F(": Interrupt source already in use on pin ") << _state.Pin << endl;
+            return;
+        }
     }
     else if (!enabled)
     {
-        detachInterrupt(irq);
-        pSensors[irq] = NULL;
+        Attach(false);
     }
 
     _state.Enabled = enabled;
@@ -115,180 +423,2112 @@ void RotationSensor::Enable(bool enabled)
 
 
 /*******************************************************************************
- Returns the enabled state of the rotation sensor counter.
+ Connects the sensor to (or disconnects it from) its interrupt source. Returns
+ false if the interrupt source cannot be used by the sensor.
 *******************************************************************************/
-inline bool RotationSensor::Enabled()
+bool RotationSensor::Attach(bool attach)
 {
-    return (_state.IRQ != NOT_AN_INTERRUPT) && _state.Enabled;
+    switch (_state.Backend)
+    {
+        case ExternalBackend:  AttachExternal(attach); return true;
+        case PinChangeBackend: return AttachPinChange(attach);
+        case CaptureBackend:   return AttachCapture(attach);
+        case CounterBackend:   return AttachCounter(attach);
+        default:               return false;
+    }
 }
 
 
 /*******************************************************************************
- Returns the sensor count data. The return value is a CountData structure
- containing the accumulated pulse count and time (in microseconds) since the
- sensor was last reset, as well the ID of the sensor (as the pin number) and
- the pulses/revolution setting for the sensor.
+ Registers the sensor for its external interrupt and unmasks the interrupt, or
+ masks the interrupt and unregisters the sensor.
 *******************************************************************************/
-RotationSensor::CountData RotationSensor::Read()
+void RotationSensor::AttachExternal(bool attach)
 {
-    CountData data;
+    uint8_t mode = _state.Quadrature;
 
-    data.SensorID = _state.Pin;
-    data.CountsPerRev = _state.PulsesPerRev;
+    // A quadrature encoder in 2X or 4X mode is decoded on both edges of A, and
+    // in 4X mode also on both edges of B.
+    AttachExternal(_state.IRQ, (mode == 0 || mode == Quadrature1X) ? RISING : CHANGE, attach);
 
-    if (Enabled())
-    {
-        // Disable interrupts while reading sensor values to make sure we don't get
-        // inconsistent values (e.g., if a sensor interrupt occurs between the following
-        // lines then the values will be mis-matched).
-        noInterrupts();
-        uint32_t count     = _count;
-        uint32_t endTime   = _lastPulseTime;
-        uint32_t prevTime  = _prevPulseTime;
-        interrupts();
+#if ROTATIONSENSOR_QUADRATURE
+    if (mode == Quadrature4X) AttachExternal(_irqB, CHANGE, attach);
+#endif
+}
 
-        data.Count          = count;
-        data.LastCountTime  = endTime;
-        data.LastInterval   = (prevTime == 0) ? 0 : (endTime - prevTime);
 
-        TRACE(Logger(_classname_, __func__, this) << '[' << data.SensorID << ']'
-                                                  << F(": count=") << count
-                                                  << F(", endTime=") << endTime
-                                                  << F(", LastInterval=") << data.LastInterval
-                                                  << F(", CountsPerRev=") << data.CountsPerRev
-                                                  << endl);
-    }
+/*******************************************************************************
+ Registers the sensor for the given external interrupt, triggered on a RISING
+ or FALLING edge or any CHANGE, or unregisters it.
+*******************************************************************************/
+void RotationSensor::AttachExternal(int irq, int mode, bool attach)
+{
+    if (attach)
+    {
+        pSensors[irq] = this;
 
-    return data;
+#if ROTATIONSENSOR_DIRECT_ISR
+        // Select the edge on INTn, clear any stale interrupt flag and unmask
+        uint8_t sense = (mode == RISING) ? (_BV(ISC01) | _BV(ISC00)) : (mode == FALLING) ? _BV(ISC01) : _BV(ISC00);
+
+        uint16_t start = DisableInterrupts();
+        EICRA  = (EICRA & ~((_BV(ISC01) | _BV(ISC00)) << (2 * irq))) | (sense << (2 * irq));
+        EIFR   = _BV(irq);
+        EIMSK |= _BV(irq);
+        EnableInterrupts(start);
+#elif defined(ARDUINO_ARCH_ESP32)
+        attachInterruptArg(irq, RotationSensor_ExternalISR, this, mode);
+#else
+        attachInterrupt(irq, RotationSensorISRTable<EXTERNAL_NUM_INTERRUPTS>::Get(irq), mode);
+#endif
+    }
+    else
+    {
+#if ROTATIONSENSOR_DIRECT_ISR
+        EIMSK &= ~_BV(irq);
+#else
+        detachInterrupt(irq);
+#endif
+        pSensors[irq] = NULL;
+    }
 }
 
 
 /*******************************************************************************
- Returns the current sensor count.
+ Returns the enabled state of the rotation sensor counter.
 *******************************************************************************/
-uint32_t RotationSensor::ReadCount()
+bool RotationSensor::Enabled()
 {
-    uint32_t count = 0;
+    return Attached() && _state.Enabled;
+}
 
-    if (Enabled())
-    {
-        // Disable interrupts while reading count.
-        noInterrupts();
-        count = _count;
-        interrupts();
-    }
 
-    return count;
+/*******************************************************************************
+ Sets the time, in milliseconds, without a pulse after which the sensor is
+ considered stalled.
+*******************************************************************************/
+void RotationSensor::SetStallTimeout(uint16_t timeout)
+{
+#if ROTATIONSENSOR_STALL_DETECTION
+    _stallTimeout = RotationSensorTimebase::MicrosToTicks(timeout * 1000UL);
+#else
+    (void)timeout;
+#endif
 }
 
 
 /*******************************************************************************
- Returns the sensor rotation rate as an RPM value. The sensor should be enabled
- before this method is called.
+ Sets the event handler and the events it is called for.
+*******************************************************************************/
+void RotationSensor::SetEventHandler(EventHandler handler, uint8_t events)
+{
+#if ROTATIONSENSOR_EVENTS
+    uint16_t start = DisableInterrupts();
+    _eventHandler = handler;
+    _eventMask = (handler != NULL) ? events : 0;
+    _eventFlags &= _eventMask;
+    EnableInterrupts(start);
+#else
+    (void)handler;
+    (void)events;
+#endif
+}
 
- Returns the RPM value, or NO_READING if the sensor is not enabled.
 
- A minimum of two pulses must occur before a reading can be made, since a
- reading is based on the time interval between pulses. So, if the sensor is moving
- slowly (or not at all) then 0 will be returned until 2 readings have been made.
+/*******************************************************************************
+ Sets the number of pulses between PulseEvents.
 *******************************************************************************/
-float RotationSensor::ReadRPM()
+void RotationSensor::SetPulseEvent(uint16_t pulses)
 {
-    if (!Enabled()) return (float)NO_READING;
+#if ROTATIONSENSOR_EVENTS
+    uint16_t start = DisableInterrupts();
+    _pulseEvery = pulses;
+    _pulseCountdown = pulses;
+    EnableInterrupts(start);
+#else
+    (void)pulses;
+#endif
+}
 
-    CountData data = Read();
 
-    return data.RPM();
+/*******************************************************************************
+ Sets the RPM threshold of the ThresholdEvent. The threshold is kept as the
+ equivalent pulse interval so the ISR only needs a compare.
+*******************************************************************************/
+void RotationSensor::SetRPMThreshold(uint16_t rpm)
+{
+#if ROTATIONSENSOR_EVENTS
+    uint32_t ticks = (rpm == 0) ? 0 : RPMToTicks(rpm);
+
+    uint16_t start = DisableInterrupts();
+    _thresholdTicks = ticks;
+    EnableInterrupts(start);
+#else
+    (void)rpm;
+#endif
 }
 
 
 /*******************************************************************************
- Returns the number of revolutions measured by the sensor since the last reset.
- Since the return type is a float, fractional revolutions can be measured up to
- the sensor resolution.
+ Returns true if the pulse rate was last seen above the RPM threshold.
 *******************************************************************************/
-float RotationSensor::ReadRevs()
+bool RotationSensor::AboveThreshold()
 {
-    if (!Enabled()) return (float)NO_READING;
+#if ROTATIONSENSOR_EVENTS
+    return (_eventState & ABOVE_THRESHOLD) != 0;
+#else
+    return false;
+#endif
+}
 
-    CountData data = Read();
 
-    return data.Revs();
+/*******************************************************************************
+ Returns true if there are events waiting for Dispatch().
+*******************************************************************************/
+bool RotationSensor::EventPending()
+{
+#if ROTATIONSENSOR_EVENTS
+    return _eventFlags != 0;
+#else
+    return false;
+#endif
 }
 
 
+/*******************************************************************************
+ Delivers the pending events to the event handler.
 
-void RotationSensor::Count_ISR() volatile
+ The stall and the drop below the RPM threshold after the pulses stop cannot be
+ seen by the ISR, so they are checked here against the time since the last
+ pulse. A stall is raised once per pulse count, so it is raised again only after
+ the sensor has moved.
+*******************************************************************************/
+uint8_t RotationSensor::Dispatch()
 {
-    uint32_t now = micros();
+#if ROTATIONSENSOR_EVENTS
+    if (_eventMask == 0) return 0;
 
-//    if ((now - _lastPulseTime) < 200) return;  // 200 microsecond debounce
+    if (Enabled() && _state.Backend != CounterBackend && (_eventMask & (ThresholdEvent | StallEvent)))
+    {
+        uint32_t endTime;
+        uint32_t startTime;
+        uint16_t epoch;
+        uint32_t count = Snapshot(1, endTime, startTime, &epoch);
+        uint32_t idle  = Elapsed(endTime, epoch);
+
+        uint16_t start = DisableInterrupts();
+
+        if ((_eventState & ABOVE_THRESHOLD) && idle >= _thresholdTicks && count == _count)
+        {
+            _eventState &= ~ABOVE_THRESHOLD;
+            _eventFlags |= _eventMask & ThresholdEvent;
+        }
+
+        EnableInterrupts(start);
+
+#if ROTATIONSENSOR_STALL_DETECTION
+        if (count != 0 && count != _stallCount && _stallTimeout != 0 && idle > _stallTimeout)
+        {
+            _stallCount = count;
+
+            start = DisableInterrupts();
+            _eventFlags |= _eventMask & StallEvent;
+            EnableInterrupts(start);
+        }
+#endif
+    }
+
+    uint16_t start = DisableInterrupts();
+    uint8_t events = _eventFlags;
+    _eventFlags = 0;
+    EnableInterrupts(start);
 
-    _prevPulseTime = _lastPulseTime;
-    _lastPulseTime = now;
-    _count++;
+    for (uint8_t event = PulseEvent; event <= StallEvent; event <<= 1)
+    {
+        if ((events & event) && _eventHandler != NULL) _eventHandler(*this, (CountEvent)event);
+    }
 
-//#if DEBUG
-//    debugTime[debugIdx] = lastPulseTime[0];
-//    debugCount[debugIdx] = pulseCount[0];
-//    debugIdx = (debugIdx + 1) & (debugStackSize-1);
-//#endif
+    return events;
+#else
+    return 0;
+#endif
 }
 
 
 /*******************************************************************************
- Interrupt Service Routines (ISR)
-
- Currently, two sensors are supported on IRQ 0 (pin 2) and IRQ 1 (pin 3). Since
- there is no inherent way to distinguish which sensor is triggering the interrupt,
- each sensor must have its own interrupt. So there are 2 ISR functions with
- essentially identical code, differing only by the index used to access the
- respective variables.
-
- Hopefully, the compiler will be able to optimize away the array indexing since
- the indexes are all constants, so they should just resolve at compile time to
- absolute, constant memory addresses.
+ Puts the MCU to sleep until the next interrupt.
 *******************************************************************************/
-void RotationSensor_ISR_0()
+void RotationSensor::Sleep()
 {
-    auto pSensor = pSensors[0];
-
-    if (pSensor != NULL) pSensor->Count_ISR();
+    SleepUnless(NULL);
 }
 
 
-void RotationSensor_ISR_1()
+/*******************************************************************************
+ Sleeps until an event is pending or the timeout expires.
+*******************************************************************************/
+bool RotationSensor::SleepUntilEvent(uint16_t timeout)
 {
-    auto pSensor = pSensors[1];
+#if ROTATIONSENSOR_LOW_POWER
+    uint32_t start = RotationSensorTimebase::Now();
+    uint32_t ticks = RotationSensorTimebase::MicrosToTicks(timeout * 1000UL);
+
+    while (!EventPending() && (timeout == 0 || RotationSensorTimebase::Now() - start < ticks))
+    {
+#if ROTATIONSENSOR_EVENTS
+        SleepUnless(&_eventFlags);
+#else
+        SleepUnless(NULL);
+#endif
+    }
+#else
+    (void)timeout;
+#endif
 
-    if (pSensor != NULL) pSensor->Count_ISR();
+    return EventPending();
 }
 
 
-void RotationSensor_DebugDump()
+/*******************************************************************************
+ Puts the MCU to sleep until the next interrupt, unless *pending is non-zero.
+ The flag is tested with interrupts disabled, and the instruction after sei()
+ always executes before any pending interrupt, so an interrupt that sets the
+ flag cannot be missed between the test and the sleep.
+*******************************************************************************/
+void RotationSensor::SleepUnless(volatile uint8_t* pending)
 {
-#if DEBUG
-    uint32_t times[debugStackSize];
-    uint32_t counts[debugStackSize];
+#if ROTATIONSENSOR_LOW_POWER
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER2
+    set_sleep_mode(SLEEP_MODE_PWR_SAVE);
+#else
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+#endif
 
-    noInterrupts();
-    for (int i=0; i < debugStackSize; i++)
-    {
-        times[i]   = debugTime[i];
-        counts[i]  = debugCount[i];
-    }
-    interrupts();
+    RotationSensorTimebase::PrepareSleep();
 
-    Logger(__func__) << F(": Index, Time, Count") << endl;
+    cli();
 
-    for (int i=0; i < debugStackSize; i++)
+    if (pending == NULL || *pending == 0)
     {
-        Logger(__func__) << i << F(", ") << times[i] << F(", ") << counts[i] << endl;
+        sleep_enable();
+#if defined(BODS) && defined(BODSE)
+        sleep_bod_disable();
+#endif
+        sei();
+        sleep_cpu();
+        sleep_disable();
     }
+
+    sei();
+#else
+    (void)pending;
 #endif
 }
 
 
+/*******************************************************************************
+ Returns the sensor count data. The return value is a CountData structure
+ containing the accumulated pulse count and time (in microseconds) since the
+ sensor was last reset, as well the ID of the sensor (as the pin number) and
+ the pulses/revolution setting for the sensor.
+*******************************************************************************/
+RotationSensor::CountData RotationSensor::Read()
+{
+    CountData data;
+
+    data.SensorID = _state.Pin;
+    data.CountsPerRev = _state.PulsesPerRev;
+
+    if (Enabled() && _state.Backend == CounterBackend)
+    {
+        uint32_t endTime;
+        uint32_t ticks;
+        uint32_t pulses;
+
+        data.Count          = MeasureCounter(endTime, ticks, pulses);
+        data.LastCountTime  = RotationSensorTimebase::TicksToMicros(endTime);
+        SetInterval(data, (pulses == 0) ? 0 : RotationSensorTimebase::TicksToMicros(ticks / pulses));
+        data.Valid          = (pulses != 0);
+#if ROTATIONSENSOR_EXTENDED_TIME
+        // The gate ended less than a wrap period ago
+        uint64_t now = RotationSensorTimebase::NowExtended();
+
+        data.LastCountTime64 = RotationSensorTimebase::TicksToMicros64(now - ((uint32_t)now - endTime));
+#endif
+    }
+    else if (Enabled())
+    {
+        Sample sample;
+
+        sample.Count = Snapshot(1, sample.EndTime, sample.PrevTime, &sample.Epoch);
+        data = FromSample(sample);
+
+        TRACE(Logger(_classname_, __func__, this) << '[' << data.SensorID << ']'
+                                                  << F(": count=") << sample.Count
+                                                  << F(", endTime=") << sample.EndTime
+                                                  << F(", LastInterval=") << data.LastInterval
+                                                  << F(", CountsPerRev=") << data.CountsPerRev
+                                                  << endl);
+    }
+
+    return data;
+}
+
+
+/*******************************************************************************
+ Copies the pulse state of the sensor. The caller must make sure that no pulse
+ is recorded during the copy, either with the sequence number or by disabling
+ interrupts.
+*******************************************************************************/
+void RotationSensor::CopySample(Sample& sample)
+{
+    uint32_t count = _count;
+
+    sample.Count    = count;
+    sample.EndTime  = PulseTime(count, count - 1);
+    sample.PrevTime = PulseTime(count, count - 2);
+#if ROTATIONSENSOR_EXTENDED_TIME
+    sample.Epoch    = _epoch;
+#else
+    sample.Epoch    = 0;
+#endif
+#if ROTATIONSENSOR_QUADRATURE
+    sample.Position = (_state.Quadrature != 0) ? _position : (int32_t)count;
+#else
+    sample.Position = (int32_t)count;
+#endif
+}
+
+
+/*******************************************************************************
+ Returns the count data of a copy of the pulse state of the sensor.
+*******************************************************************************/
+RotationSensor::CountData RotationSensor::FromSample(const Sample& sample)
+{
+    CountData data;
+    uint32_t  count = sample.Count;
+
+    data.SensorID       = _state.Pin;
+    data.CountsPerRev   = _state.PulsesPerRev;
+    data.Count          = count;
+    data.LastCountTime  = (count < 1) ? 0 : RotationSensorTimebase::TicksToMicros(sample.EndTime);
+    SetInterval(data, (count < 2) ? 0 : RotationSensorTimebase::TicksToMicros(sample.EndTime - sample.PrevTime));
+    data.Valid          = (count >= 2);
+#if ROTATIONSENSOR_EXTENDED_TIME
+    // Keep the wrap count of the timebase current
+    RotationSensorTimebase::NowExtended();
+
+    data.LastCountTime64 = (count < 1) ? 0 : RotationSensorTimebase::TicksToMicros64(((uint64_t)sample.Epoch << 32) | sample.EndTime);
+#endif
+
+    return data;
+}
+
+
+/*******************************************************************************
+ Returns the current sensor count.
+*******************************************************************************/
+uint32_t RotationSensor::ReadCount()
+{
+    uint32_t count = 0;
+
+    if (Enabled() && _state.Backend == CounterBackend)
+    {
+        uint32_t endTime;
+        uint32_t ticks;
+        uint32_t pulses;
+
+        count = MeasureCounter(endTime, ticks, pulses);
+    }
+    else if (Enabled())
+    {
+        uint8_t seq;
+
+        do
+        {
+            seq = BeginRead();
+            count = _count;
+        }
+        while (!EndRead(seq));
+    }
+
+    return count;
+}
+
+
+/*******************************************************************************
+ Returns the signed position of a quadrature encoder, or the count for a single
+ channel sensor.
+*******************************************************************************/
+int32_t RotationSensor::ReadPosition()
+{
+#if ROTATIONSENSOR_QUADRATURE
+    if (_state.Quadrature != 0)
+    {
+        int32_t position = 0;
+
+        if (Enabled())
+        {
+            uint8_t seq;
+
+            do
+            {
+                seq = BeginRead();
+                position = _position;
+            }
+            while (!EndRead(seq));
+        }
+
+        return position;
+    }
+#endif
+
+    return (int32_t)ReadCount();
+}
+
+
+/*******************************************************************************
+ Returns the direction of the last quadrature encoder count.
+*******************************************************************************/
+int8_t RotationSensor::ReadDirection()
+{
+#if ROTATIONSENSOR_QUADRATURE
+    return (_quadState & 0x80) ? -1 : 1;
+#else
+    return 1;
+#endif
+}
+
+
+/*******************************************************************************
+ Copies the timestamps of the most recent sensor pulses into the times array,
+ oldest first, and returns the number of timestamps copied.
+*******************************************************************************/
+uint8_t RotationSensor::ReadHistory(uint32_t times[], uint8_t n, uint32_t* pCount)
+{
+    uint32_t count;
+    uint8_t  copied;
+    uint8_t  seq;
+
+    if (n > HISTORY_SIZE) n = HISTORY_SIZE;
+
+    do
+    {
+        seq = BeginRead();
+        count = _count;
+        copied = (count < n) ? (uint8_t)count : n;
+
+        uint32_t idx  = count - 1;
+        uint32_t time = PulseTime(count, idx);
+
+        // From the newest back, so each timestamp is found from the next one
+        for (uint8_t i=copied; i > 0; i--, idx--)
+        {
+            times[i - 1] = time;
+            if (i > 1) time = OlderTime(count, idx, time);
+        }
+    }
+    while (!EndRead(seq));
+
+    if (pCount != NULL) *pCount = count;
+
+    return copied;
+}
+
+
+/*******************************************************************************
+ Returns the sensor rotation rate as an RPM value. The sensor should be enabled
+ before this method is called.
+
+ Returns the RPM value, or NO_READING if the sensor is not enabled.
+
+ A minimum of two pulses must occur before a reading can be made, since a
+ reading is based on the time interval between pulses. So, if the sensor is moving
+ slowly (or not at all) then 0 will be returned until 2 readings have been made.
+*******************************************************************************/
+float RotationSensor::ReadRPM()
+{
+    return ReadRPM(1);
+}
+
+
+/*******************************************************************************
+ Returns the sensor rotation rate as an RPM value averaged over the last
+ windowPulses pulse intervals, or NO_READING if the sensor is not enabled.
+
+ The pulses in the window span (t[n] - t[n-N]) ticks, so the average only needs
+ the two timestamps at the ends of the window.
+*******************************************************************************/
+float RotationSensor::ReadRPM(uint8_t windowPulses)
+{
+    if (!Enabled()) return (float)NO_READING;
+
+    uint32_t ticks;
+    uint32_t pulses;
+
+    Measure(windowPulses, ticks, pulses);
+
+    float rpm = (pulses == 0 || ticks == 0) ? 0.0 : ((float)_rpmK * pulses / ticks);
+
+    return rpm * ReadDirection();
+}
+
+
+/*******************************************************************************
+ Returns the RPM, measured from the pulse interval at low speed and from the
+ pulse count over a gate time at high speed.
+
+ In frequency mode the gate runs from a pulse to the first pulse seen by a read
+ at least a gate time later, so both its count and its duration are exact to
+ the timestamp resolution. Until the first gate ends, the reading is the
+ average over the pulse history.
+*******************************************************************************/
+float RotationSensor::ReadRPMAuto()
+{
+#if ROTATIONSENSOR_AUTO_RANGE
+    if (!Enabled()) return (float)NO_READING;
+
+    if (_state.Backend == CounterBackend) return ReadRPM();
+
+    uint32_t ticks;
+    uint32_t pulses;
+
+    Measure(1, ticks, pulses);
+
+    uint32_t interval = (pulses == 0) ? 0xFFFFFFFF : ticks / pulses;
+
+    if (_frequencyMode && interval > _crossoverTicks + _crossoverTicks / 4)
+    {
+        _frequencyMode = false;
+    }
+    else if (!_frequencyMode && interval < _crossoverTicks)
+    {
+        uint32_t startTime;
+
+        _frequencyMode = true;
+        _gateRPM = -1;
+        _gateCount = Snapshot(1, _gateTime, startTime);
+    }
+
+    if (!_frequencyMode)
+    {
+        float rpm = (pulses == 0 || ticks == 0) ? 0.0 : ((float)_rpmK * pulses / ticks);
+
+        return rpm * ReadDirection();
+    }
+
+    uint32_t endTime;
+    uint32_t startTime;
+    uint32_t count = Snapshot(1, endTime, startTime);
+    uint32_t gate  = endTime - _gateTime;
+
+    if (count != _gateCount && gate >= RotationSensorTimebase::MicrosToTicks(ROTATIONSENSOR_AUTO_GATE_MS * 1000UL))
+    {
+        _gateRPM = (float)_rpmK * (count - _gateCount) / gate;
+        _gateCount = count;
+        _gateTime = endTime;
+    }
+
+    if (_gateRPM < 0) return ReadRPM(HISTORY_SIZE - 1);
+
+    return _gateRPM * ReadDirection();
+#else
+    return ReadRPM();
+#endif
+}
+
+
+/*******************************************************************************
+ Sets the RPM above which ReadRPMAuto() switches to frequency mode.
+*******************************************************************************/
+void RotationSensor::SetAutoCrossover(uint16_t rpm)
+{
+#if ROTATIONSENSOR_AUTO_RANGE
+    _crossoverTicks = (rpm == 0) ? 64UL * RotationSensorTimebase::RESOLUTION : RPMToTicks(rpm);
+#else
+    (void)rpm;
+#endif
+}
+
+
+/*******************************************************************************
+ Returns true if ReadRPMAuto() was last in frequency mode.
+*******************************************************************************/
+bool RotationSensor::AutoFrequencyMode()
+{
+#if ROTATIONSENSOR_AUTO_RANGE
+    return _frequencyMode;
+#else
+    return false;
+#endif
+}
+
+
+/*******************************************************************************
+ Returns the acceleration in RPM per second.
+
+ With the N = ACCEL_WINDOW intervals d(i) = t(i) - t(i-1), i = 1..N, ending at
+ the last pulse t(N), the least squares slope of d over i is
+
+     b = 6 * (2 * P - (N + 1) * W) / (N * (N^2 - 1))
+
+ where W = t(N) - t(0) is the sum of the intervals and P = sum(i * d(i)), which
+ telescopes to N * t(N) - sum(t(0) .. t(N-1)). The ISR keeps that timestamp
+ sum, so P costs a multiply. The intervals change by b ticks per pulse at an
+ average interval of d = W / N, and the rate is _rpmK / d, so the acceleration
+ is -_rpmK * b / d^3 RPM per tick.
+*******************************************************************************/
+float RotationSensor::ReadAcceleration()
+{
+#if ROTATIONSENSOR_ACCELERATION
+    if (!Enabled() || _state.Backend == CounterBackend) return 0;
+
+    const uint8_t N = ACCEL_WINDOW;
+
+    uint32_t count;
+    uint32_t endTime;
+    uint32_t startTime;
+    uint32_t sum;
+    uint16_t epoch = 0;
+    uint8_t  seq;
+
+    do
+    {
+        seq = BeginRead();
+        count = _count;
+        sum = _timeSum;
+#if ROTATIONSENSOR_EXTENDED_TIME
+        epoch = _epoch;
+#endif
+
+        endTime   = PulseTime(count, count - 1);
+        startTime = PulseTime(count, count - 1 - N);
+    }
+    while (!EndRead(seq));
+
+    uint32_t span = endTime - startTime;
+
+    // P must not overflow, which limits the window to about 8 minutes of
+    // microseconds with the default history
+    if (count <= N || span == 0 || span > 0xFFFFFFFFUL / N) return 0;
+
+#if ROTATIONSENSOR_STALL_DETECTION
+    if (_stallTimeout != 0 && Elapsed(endTime, epoch) >= _stallTimeout) return 0;
+#else
+    (void)epoch;
+#endif
+
+    // P and the numerator are integers, and are kept exact: as floats they
+    // would lose the low bits once the timestamps pass 2^24
+    uint32_t P = N * endTime - sum;
+    int64_t  numerator = 2 * (int64_t)P - (int64_t)(N + 1) * span;
+
+    float b = 6.0f * (float)numerator / (N * ((uint16_t)N * N - 1));
+    float d = (float)span / N;
+
+    return -(float)_rpmK * b / (d * d * d) * RotationSensorTimebase::TICKS_PER_SECOND;
+#else
+    return 0;
+#endif
+}
+
+
+/*******************************************************************************
+ Returns the number of revolutions measured by the sensor since the last reset.
+ Since the return type is a float, fractional revolutions can be measured up to
+ the sensor resolution.
+*******************************************************************************/
+float RotationSensor::ReadRevs()
+{
+    if (!Enabled()) return (float)NO_READING;
+
+    CountData data = Read();
+
+    return data.Revs();
+}
+
+
+
+/*******************************************************************************
+ Returns the sensor rotation rate as a Q16.16 fixed point RPM value.
+*******************************************************************************/
+uint32_t RotationSensor::ReadRPM_Q16(uint8_t windowPulses)
+{
+    if (!Enabled()) return 0;
+
+    uint32_t ticks;
+    uint32_t pulses;
+
+    Measure(windowPulses, ticks, pulses);
+
+    return RPMFromTicks(ticks, pulses, 65536UL);
+}
+
+
+/*******************************************************************************
+ Returns the sensor rotation rate in thousandths of an RPM.
+*******************************************************************************/
+uint32_t RotationSensor::ReadMilliRPM(uint8_t windowPulses)
+{
+    if (!Enabled()) return 0;
+
+    uint32_t ticks;
+    uint32_t pulses;
+
+    Measure(windowPulses, ticks, pulses);
+
+    return RPMFromTicks(ticks, pulses, 1000);
+}
+
+
+/*******************************************************************************
+ Caches the Q16.16 RPM for LatestRPM_Q16(). The store takes several instructions
+ on 8 bit MCUs, so it is made with interrupts disabled.
+*******************************************************************************/
+void RotationSensor::Update(uint8_t windowPulses)
+{
+#if ROTATIONSENSOR_RPM_CACHE
+    uint32_t rpm = ReadRPM_Q16(windowPulses);
+
+    uint16_t start = DisableInterrupts();
+    _latestRPM = rpm;
+    EnableInterrupts(start);
+#else
+    (void)windowPulses;
+#endif
+}
+
+
+/*******************************************************************************
+ Returns the number of revolutions since the last reset as a Q24.8 fixed point
+ value. The division is split into quotient and remainder so the count can be
+ scaled without overflowing.
+*******************************************************************************/
+uint32_t RotationSensor::ReadRevsQ8()
+{
+    if (!Enabled()) return 0;
+
+    uint32_t count = ReadCount();
+    uint16_t ppr   = _state.PulsesPerRev;
+
+    return ((count / ppr) << 8) + (((count % ppr) << 8) / ppr);
+}
+
+
+/*******************************************************************************
+ Returns num * scale / den computed with 32 bit integer math. The quotient is
+ scaled directly, and the remainder (which is less than den) is scaled after
+ reducing den, if needed, so that the product fits in 32 bits.
+*******************************************************************************/
+uint32_t RotationSensor::ScaledDivide(uint32_t num, uint32_t den, uint32_t scale)
+{
+    if (den == 0) return 0xFFFFFFFFUL;
+
+    uint32_t q = num / den;
+    uint32_t r = num % den;
+
+    if (q >= 0xFFFFFFFFUL / scale) return 0xFFFFFFFFUL;
+
+    while (den > 0xFFFFFFFFUL / scale)
+    {
+        den >>= 1;
+        r >>= 1;
+    }
+
+    return (q * scale) + (r * scale) / den;
+}
+
+
+/*******************************************************************************
+ Returns the rotation rate, multiplied by scale, for 'pulses' pulses spanning
+ 'ticks' timebase ticks, or 0 if there is no measurement.
+*******************************************************************************/
+uint32_t RotationSensor::RPMFromTicks(uint32_t ticks, uint32_t pulses, uint32_t scale)
+{
+    if (pulses == 0 || ticks == 0) return 0;
+
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_CYCCNT
+    // The 64 bit product of the constant (at most 60 * 2^32) and the scale
+    // (at most 2^16) cannot overflow
+    uint64_t product = (_rpmK * scale) / ticks;
+    uint32_t rate = (product >= 0xFFFFFFFFULL) ? 0xFFFFFFFFUL : (uint32_t)product;
+#else
+    uint32_t rate = ScaledDivide(_rpmK, ticks, scale);
+#endif
+
+    if (pulses > 1)
+    {
+        if (rate >= 0xFFFFFFFFUL / pulses) return 0xFFFFFFFFUL;
+
+        rate *= pulses;
+    }
+
+    return rate;
+}
+
+
+/*******************************************************************************
+ Returns the pulse interval at an RPM, saturated to 32 bits.
+*******************************************************************************/
+uint32_t RotationSensor::RPMToTicks(uint16_t rpm)
+{
+    RPMConstant ticks = _rpmK / rpm;
+
+    return ((uint64_t)ticks >= 0xFFFFFFFFULL) ? 0xFFFFFFFFUL : (uint32_t)ticks;
+}
+
+
+/*******************************************************************************
+ Measures the time (in timebase ticks) spanned by the last 'window' pulse
+ intervals, limited by the pulse history size and by the number of pulses that
+ have occurred. Returns the pulse count; pulses receives the number of pulse
+ intervals actually measured, which is 0 if there is no measurement.
+*******************************************************************************/
+uint32_t RotationSensor::Measure(uint8_t window, uint32_t& ticks, uint32_t& pulses)
+{
+    if (_state.Backend == CounterBackend)
+    {
+        uint32_t endTime;
+
+        return MeasureCounter(endTime, ticks, pulses);
+    }
+
+    if (window > HISTORY_SIZE - 1) window = HISTORY_SIZE - 1;
+    if (window < 1) window = 1;
+
+    uint32_t endTime;
+    uint32_t startTime;
+    uint16_t epoch;
+
+#if ROTATIONSENSOR_COMPACT
+    // The intervals before the last one are only known modulo 65536 ticks, so
+    // only use them while the last interval leaves room for the speed to halve
+    if (window > 1 && Snapshot(1, endTime, startTime) >= 2 && endTime - startTime >= 0x8000) window = 1;
+#endif
+
+    uint32_t count = Snapshot(window, endTime, startTime, &epoch);
+
+    if (count <= window)
+    {
+        // Not enough pulses yet for the full window, so use what there is
+        if (count < 2)
+        {
+            ticks = pulses = 0;
+            return count;
+        }
+
+        window = (uint8_t)(count - 1);
+        count = Snapshot(window, endTime, startTime, &epoch);
+    }
+
+    ticks  = endTime - startTime;
+    pulses = window;
+
+#if ROTATIONSENSOR_STALL_DETECTION
+    // If the time since the last pulse is longer than the average interval
+    // measured, the sensor has slowed down by at least that much, so measure
+    // up to now instead. Assume no speed at all once the stall timeout expires.
+    uint32_t elapsed = Elapsed(endTime, epoch);
+
+    if (elapsed > (ticks / pulses))
+    {
+        if (_stallTimeout != 0 && elapsed >= _stallTimeout)
+        {
+            ticks = pulses = 0;
+        }
+        else
+        {
+            ticks  = elapsed;
+            pulses = 1;
+        }
+    }
+#endif
+
+    return count;
+}
+
+
+/*******************************************************************************
+ Copies the pulse history entries recorded since the last call into the entries
+ array, oldest first, and returns the number of entries copied.
+
+ Each entry is copied under its own sequence check, so interrupts are never
+ masked and the ISR is held off for no longer than a single read. An entry that
+ the ISR overwrites before it is copied is counted as lost, and the drain
+ continues from the oldest entry still in the history.
+*******************************************************************************/
+uint8_t RotationSensor::DrainTrace(TraceEntry entries[], uint8_t n, uint32_t* pLost)
+{
+    uint32_t next = _drained;
+    uint32_t lost = 0;
+    uint8_t  copied = 0;
+
+    while (copied < n)
+    {
+        uint32_t count;
+        uint32_t index;
+        uint32_t time = 0;
+        uint8_t  seq;
+
+        // Only look up the time of an entry that is still in the history
+        do
+        {
+            seq = BeginRead();
+            count = _count;
+            index = (count - next > HISTORY_SIZE) ? count - HISTORY_SIZE : next;
+            if (count != index) time = PulseTime(count, index);
+        }
+        while (!EndRead(seq));
+
+        if (count == next) break;
+
+        // The entries before index have been overwritten
+        lost += index - next;
+        next = index;
+
+        entries[copied].Count = ++next;
+        entries[copied].Time = time;
+        copied++;
+    }
+
+    _drained = next;
+
+    if (pLost != NULL) *pLost = lost;
+
+    return copied;
+}
+
+
+/*******************************************************************************
+ Returns the number of pulses rejected by the debounce filter since the last
+ reset.
+*******************************************************************************/
+uint16_t RotationSensor::ReadRejected()
+{
+#if ROTATIONSENSOR_DEBOUNCE
+    uint16_t rejected;
+    uint8_t  seq;
+
+    do
+    {
+        seq = BeginRead();
+        rejected = _rejected;
+    }
+    while (!EndRead(seq));
+
+    return rejected;
+#else
+    return 0;
+#endif
+}
+
+
+/*******************************************************************************
+ Returns the profiling counters of the sensor.
+*******************************************************************************/
+RotationSensor::Stats RotationSensor::ReadStats()
+{
+    Stats stats;
+
+#if ROTATIONSENSOR_PROFILING
+    uint16_t start = DisableInterrupts();
+    stats = _stats;
+    EnableInterrupts(start);
+#endif
+
+    return stats;
+}
+
+
+/*******************************************************************************
+ Clears the profiling counters of the sensor.
+*******************************************************************************/
+void RotationSensor::ResetStats()
+{
+#if ROTATIONSENSOR_PROFILING
+    uint16_t start = DisableInterrupts();
+    _stats = Stats();
+    EnableInterrupts(start);
+#endif
+}
+
+
+/*******************************************************************************
+ Returns the pulse interval statistics of the sensor, and optionally clears
+ them in the same critical section, so no interval is counted twice or lost.
+*******************************************************************************/
+RotationSensor::IntervalStats RotationSensor::ReadIntervalStats(bool reset)
+{
+    IntervalStats stats;
+
+#if ROTATIONSENSOR_INTERVAL_STATS
+    uint16_t start = DisableInterrupts();
+    stats = _intervals;
+    if (reset) _intervals = IntervalStats();
+    EnableInterrupts(start);
+#else
+    (void)reset;
+#endif
+
+    return stats;
+}
+
+
+/*******************************************************************************
+ Waits for any pulse history update in progress to complete and returns the
+ sequence number to pass to EndRead() once the values have been copied.
+
+ On a single core MCU the ISR always runs to completion before the caller
+ resumes, so the sequence number is never observed as odd here. The check
+ only matters when the reader can run concurrently with the ISR.
+*******************************************************************************/
+uint8_t RotationSensor::BeginRead()
+{
+    uint8_t seq;
+
+    while ((seq = _seq) & 1) { }
+
+    SeqFence();
+
+    return seq;
+}
+
+
+/*******************************************************************************
+ Takes a consistent snapshot of the pulse count, the timestamp of the last pulse
+ and the timestamp of the pulse that occurred 'window' pulses before it, without
+ masking interrupts. The timestamps are only meaningful if the returned count is
+ greater than 0 (endTime) or greater than window (startTime). If pEpoch is not
+ NULL it receives the timebase wrap count of endTime, which is 0 without
+ ROTATIONSENSOR_EXTENDED_TIME.
+*******************************************************************************/
+uint32_t RotationSensor::Snapshot(uint8_t window, uint32_t& endTime, uint32_t& startTime, uint16_t* pEpoch)
+{
+    uint32_t count;
+    uint8_t  seq;
+
+    do
+    {
+        seq = BeginRead();
+        count = _count;
+
+        endTime   = PulseTime(count, count - 1);
+        startTime = PulseTime(count, count - 1 - window);
+#if ROTATIONSENSOR_EXTENDED_TIME
+        if (pEpoch != NULL) *pEpoch = _epoch;
+#endif
+    }
+    while (!EndRead(seq));
+
+#if !ROTATIONSENSOR_EXTENDED_TIME
+    if (pEpoch != NULL) *pEpoch = 0;
+#endif
+
+    return count;
+}
+
+
+/*******************************************************************************
+ Returns the ticks elapsed since a pulse timestamp with the given wrap count
+ (see Snapshot()). Without ROTATIONSENSOR_EXTENDED_TIME the difference wraps
+ around, so a pulse more than a wrap period ago looks recent; with it the
+ result saturates at 0xFFFFFFFF.
+*******************************************************************************/
+uint32_t RotationSensor::Elapsed(uint32_t time, uint16_t epoch)
+{
+#if ROTATIONSENSOR_EXTENDED_TIME
+    uint64_t elapsed = RotationSensorTimebase::NowExtended() - (((uint64_t)epoch << 32) | time);
+
+    return (elapsed > 0xFFFFFFFFUL) ? 0xFFFFFFFFUL : (uint32_t)elapsed;
+#else
+    (void)epoch;
+    return RotationSensorTimebase::Now() - time;
+#endif
+}
+
+
+/*******************************************************************************
+ Pulse handler called by the ISR of every backend with the pulse timestamp.
+*******************************************************************************/
+ROTATIONSENSOR_IRAM_ATTR void RotationSensor::Count_ISR(uint32_t now) volatile
+{
+#if ROTATIONSENSOR_PROFILING
+    uint16_t start = RotationSensorTimebase::ProfileClock();
+#endif
+
+    bool counted = CountPulse(now);
+
+#if ROTATIONSENSOR_EVENTS
+    if (counted && _eventMask != 0) Event_ISR(now);
+#else
+    (void)counted;
+#endif
+
+#if ROTATIONSENSOR_PROFILING
+    ProfileISR(start, now);
+#endif
+}
+
+
+/*******************************************************************************
+ Updates the running sum of the timestamps fitted by ReadAcceleration() for the
+ pulse about to be recorded as number count (from 0): the last timestamp joins
+ the sum and the one ACCEL_WINDOW pulses before it leaves. Called while the
+ sequence number is odd.
+*******************************************************************************/
+inline ROTATIONSENSOR_IRAM_ATTR void RotationSensor::AccumulateTime(uint32_t count) volatile
+{
+#if ROTATIONSENSOR_ACCELERATION
+    if (count == 0) return;
+
+    uint32_t sum = _timeSum + PulseTime(count, count - 1);
+
+    if (count > ACCEL_WINDOW) sum -= PulseTime(count, count - 1 - ACCEL_WINDOW);
+
+    _timeSum = sum;
+#else
+    (void)count;
+#endif
+}
+
+
+/*******************************************************************************
+ Records the timebase wrap count of the pulse being recorded, for the extended
+ timestamps. Called while the sequence number is odd.
+*******************************************************************************/
+inline ROTATIONSENSOR_IRAM_ATTR void RotationSensor::RecordEpoch(uint32_t now) volatile
+{
+#if ROTATIONSENSOR_EXTENDED_TIME
+    _epoch = RotationSensorTimebase::EpochFromISR(now);
+#else
+    (void)now;
+#endif
+}
+
+
+/*******************************************************************************
+ Adds the interval that ends with the pulse about to be recorded as number
+ count (from 0) to the interval statistics. The bucket is the index of the
+ highest set bit of the interval, found with a count leading zeros (a single
+ instruction on ARM). Called while the sequence number is odd.
+*******************************************************************************/
+inline ROTATIONSENSOR_IRAM_ATTR void RotationSensor::RecordInterval(uint32_t count, uint32_t now) volatile
+{
+#if ROTATIONSENSOR_INTERVAL_STATS
+    if (count == 0) return;
+
+    IntervalStats& stats = const_cast<IntervalStats&>(_intervals);
+    uint32_t interval = now - PulseTime(count, count - 1);
+    uint8_t  bucket   = (interval == 0) ? 0 : (8 * sizeof(long) - 1) - __builtin_clzl(interval);
+
+    if (bucket >= INTERVAL_BUCKETS) bucket = INTERVAL_BUCKETS - 1;
+    if (stats.Buckets[bucket] != 0xFFFFFFFF) stats.Buckets[bucket]++;
+
+    if (stats.Intervals == 0xFFFFFFFF) return;
+    if (stats.Intervals == 0) stats.Reference = interval;
+
+    if (interval < stats.MinInterval) stats.MinInterval = interval;
+    if (interval > stats.MaxInterval) stats.MaxInterval = interval;
+
+    int32_t  delta = (int32_t)(interval - stats.Reference);
+    uint32_t magnitude = (delta < 0) ? -(uint32_t)delta : (uint32_t)delta;
+
+    stats.Intervals++;
+    stats.SumDelta += delta;
+    // A deviation below 65536 ticks is squared with a 16 x 16 bit multiply, a
+    // few MUL instructions on AVR; only the longer ones call the far slower 64
+    // bit library multiply.
+    if (magnitude <= 0xFFFF)
+        stats.SumSquares += (uint32_t)(uint16_t)magnitude * (uint16_t)magnitude;
+    else
+        stats.SumSquares += (uint64_t)magnitude * magnitude;
+#else
+    (void)count;
+    (void)now;
+#endif
+}
+
+
+/*******************************************************************************
+ Records a single channel pulse, rejecting it if it is too close to the last
+ counted pulse when DEBOUNCE is set. Returns false if the pulse was not counted.
+*******************************************************************************/
+template<bool DEBOUNCE> inline bool RotationSensor::CountEdge(uint32_t now) volatile
+{
+    uint32_t count = _count;
+
+#if ROTATIONSENSOR_DEBOUNCE
+    // Reject the pulse if it is too close to the last counted pulse
+    if (DEBOUNCE && count != 0 && (now - PulseTime(count, count - 1)) < _minInterval)
+    {
+        _seq++;
+        SeqFence();
+        if (_rejected != 0xFFFF) _rejected++;
+        SeqFence();
+        _seq++;
+        return false;
+    }
+#endif
+
+    _seq++;
+    SeqFence();
+    AccumulateTime(count);
+    RecordInterval(count, now);
+    RecordTime(count, now);
+    RecordEpoch(now);
+    _count = count + 1;
+    SeqFence();
+    _seq++;
+
+    return true;
+}
+
+
+/*******************************************************************************
+ Records a pulse. Returns false if the pulse was not counted.
+*******************************************************************************/
+ROTATIONSENSOR_IRAM_ATTR bool RotationSensor::CountPulse(uint32_t now) volatile
+{
+#if ROTATIONSENSOR_QUADRATURE
+    if (_state.Quadrature != 0)
+    {
+        return Quadrature_ISR(now);
+    }
+#endif
+
+    return CountEdge<true>(now);
+}
+
+
+/*******************************************************************************
+ Pulse handler of the RotationSensorT ISRs, for a single channel sensor on an
+ external interrupt: the same as Count_ISR() without the quadrature dispatch,
+ and without the debounce check unless DEBOUNCE is set.
+*******************************************************************************/
+template<bool DEBOUNCE> void RotationSensor::Edge_ISR(uint32_t now) volatile
+{
+#if ROTATIONSENSOR_PROFILING
+    uint16_t start = RotationSensorTimebase::ProfileClock();
+#endif
+
+    bool counted = CountEdge<DEBOUNCE>(now);
+
+#if ROTATIONSENSOR_EVENTS
+    if (counted && _eventMask != 0) Event_ISR(now);
+#else
+    (void)counted;
+#endif
+
+#if ROTATIONSENSOR_PROFILING
+    ProfileISR(start, now);
+#endif
+}
+
+
+// GCC ignores the section of a template, except on an explicit instantiation,
+// which is where ROTATIONSENSOR_IRAM_ATTR places the template ISR paths
+template ROTATIONSENSOR_IRAM_ATTR bool RotationSensor::CountEdge<false>(uint32_t now) volatile;
+template ROTATIONSENSOR_IRAM_ATTR bool RotationSensor::CountEdge<true>(uint32_t now) volatile;
+template ROTATIONSENSOR_IRAM_ATTR void RotationSensor::Edge_ISR<false>(uint32_t now) volatile;
+template ROTATIONSENSOR_IRAM_ATTR void RotationSensor::Edge_ISR<true>(uint32_t now) volatile;
+
+
+#if ROTATIONSENSOR_QUADRATURE
+ROTATIONSENSOR_IRAM_ATTR bool RotationSensor::Quadrature_ISR(uint32_t now) volatile
+{
+    uint8_t ab   = ReadPins();
+    uint8_t prev = _quadState;
+    int8_t  step;
+
+    if (_state.Quadrature == Quadrature4X)
+    {
+        step = (int8_t)pgm_read_byte(&QuadratureTable[((prev & 0x03) << 2) | ab]);
+
+        if (step == 0)
+        {
+            _quadState = (prev & 0x80) | ab;
+            return false;
+        }
+    }
+    else
+    {
+        step = ((ab >> 1) ^ ab) & 0x01 ? 1 : -1;
+    }
+
+    uint32_t count = _count;
+
+    _seq++;
+    SeqFence();
+    _position = _position + step;
+    _quadState = (step < 0) ? (0x80 | ab) : ab;
+    AccumulateTime(count);
+    RecordInterval(count, now);
+    RecordTime(count, now);
+    RecordEpoch(now);
+    _count = count + 1;
+    SeqFence();
+    _seq++;
+
+    return true;
+}
+
+
+/*******************************************************************************
+ Returns the current state of the quadrature channels, with A in bit 1 and B in
+ bit 0.
+*******************************************************************************/
+ROTATIONSENSOR_IRAM_ATTR uint8_t RotationSensor::ReadPins() volatile
+{
+#if defined(__AVR__)
+    return ((*_inputA & _maskA) ? 0x02 : 0) | ((*_inputB & _maskB) ? 0x01 : 0);
+#else
+    return (digitalRead(_state.Pin) ? 0x02 : 0) | (digitalRead(_pinB) ? 0x01 : 0);
+#endif
+}
+#endif
+
+
+/*******************************************************************************
+ Raises the events due for the pulse just counted at now. The pulse and
+ revolution events count down to the next event, so there is no division.
+*******************************************************************************/
+#if ROTATIONSENSOR_EVENTS
+ROTATIONSENSOR_IRAM_ATTR void RotationSensor::Event_ISR(uint32_t now) volatile
+{
+    uint8_t events = 0;
+
+    if (_pulseEvery != 0 && --_pulseCountdown == 0)
+    {
+        _pulseCountdown = _pulseEvery;
+        events |= PulseEvent;
+    }
+
+    if (--_revCountdown == 0)
+    {
+        _revCountdown = _state.PulsesPerRev;
+        events |= RevolutionEvent;
+    }
+
+    uint32_t count = _count;
+
+    if (count >= 2)
+    {
+        uint8_t above = ((now - PulseTime(count, count - 2)) < _thresholdTicks) ? ABOVE_THRESHOLD : 0;
+
+        if (above != (_eventState & ABOVE_THRESHOLD))
+        {
+            _eventState = above;
+            events |= ThresholdEvent;
+        }
+    }
+
+    _eventFlags |= events & _eventMask;
+}
+#endif
+
+
+/*******************************************************************************
+ Profiling
+
+ Converts a profiling clock interval that started at start to CPU cycles,
+ saturated to 16 bits.
+*******************************************************************************/
+#if ROTATIONSENSOR_PROFILING
+static inline uint16_t ProfileCycles(uint16_t start)
+{
+    uint32_t cycles = (uint32_t)(uint16_t)(RotationSensorTimebase::ProfileClock() - start)
+                    * RotationSensorTimebase::CYCLES_PER_PROFILE_TICK;
+
+    return (cycles > 0xFFFF) ? 0xFFFF : (uint16_t)cycles;
+}
+
+
+/*******************************************************************************
+ Accounts for a pulse ISR call that started at start. The time between calls
+ is taken from the ISR timestamps, so it includes rejected pulses.
+*******************************************************************************/
+void RotationSensor::ProfileISR(uint16_t start, uint32_t now) volatile
+{
+    uint16_t cycles = ProfileCycles(start);
+    Stats& stats = const_cast<Stats&>(_stats);
+
+    if (stats.IsrCalls != 0 && (now - _lastIsrTime) < stats.MinPulseInterval)
+    {
+        stats.MinPulseInterval = now - _lastIsrTime;
+    }
+
+    _lastIsrTime = now;
+    stats.IsrCalls++;
+
+    uint32_t total = stats.IsrTotalCycles + cycles;
+    stats.IsrTotalCycles = (total < cycles) ? 0xFFFFFFFF : total;
+
+    if (cycles < stats.IsrMinCycles) stats.IsrMinCycles = cycles;
+    if (cycles > stats.IsrMaxCycles) stats.IsrMaxCycles = cycles;
+}
+
+
+/*******************************************************************************
+ Accounts for a window with interrupts disabled that started at start. Must be
+ called before interrupts are enabled again.
+*******************************************************************************/
+void RotationSensor::ProfileBlocked(uint16_t start)
+{
+    uint16_t cycles = ProfileCycles(start);
+
+    if (cycles > _stats.MaxBlockedCycles) _stats.MaxBlockedCycles = cycles;
+}
+#endif
+
+
+/*******************************************************************************
+ Pin change interrupt backend
+
+ Each pin change group has a single ISR for all its pins. The ISR reads the port
+ input register once, and compares it with the previous reading to find the
+ pins that had a rising edge. The sensors are indexed by their bit in the port.
+*******************************************************************************/
+#if ROTATIONSENSOR_USE_PCINT
+
+#if defined(PCINT2_vect)
+static const uint8_t PCINT_GROUPS = 3;
+#elif defined(PCINT1_vect)
+static const uint8_t PCINT_GROUPS = 2;
+#else
+static const uint8_t PCINT_GROUPS = 1;
+#endif
+
+static struct
+{
+    volatile uint8_t* Port;
+    uint8_t Mask;
+    uint8_t Last;
+    volatile RotationSensor* Sensors[8];
+}
+pcGroups[PCINT_GROUPS];
+
+
+void RotationSensor_PinChangeISR(uint8_t group)
+{
+    auto& g = pcGroups[group];
+
+    uint8_t  pins   = *g.Port;
+    uint32_t now    = RotationSensorTimebase::NowFromISR();
+    uint8_t  rising = pins & ~g.Last & g.Mask;
+
+    g.Last = pins;
+
+    for (uint8_t i=0; rising != 0; i++, rising >>= 1)
+    {
+        if (rising & 1) g.Sensors[i]->Count_ISR(now);
+    }
+}
+
+
+ISR(PCINT0_vect) { RotationSensor_PinChangeISR(0); }
+
+#if defined(PCINT1_vect)
+ISR(PCINT1_vect) { RotationSensor_PinChangeISR(1); }
+#endif
+
+#if defined(PCINT2_vect)
+ISR(PCINT2_vect) { RotationSensor_PinChangeISR(2); }
+#endif
+
+#endif
+
+
+/*******************************************************************************
+ Adds or removes the sensor from its pin change group. Returns false if the
+ sensor cannot be added because the group is already in use by another port.
+*******************************************************************************/
+bool RotationSensor::AttachPinChange(bool attach)
+{
+#if ROTATIONSENSOR_USE_PCINT
+    uint8_t pin   = _state.Pin;
+    uint8_t group = digitalPinToPCICRbit(pin);
+    uint8_t mask  = digitalPinToBitMask(pin);
+    uint8_t bit   = 0;
+
+    auto& g = pcGroups[group];
+    volatile uint8_t* port = portInputRegister(digitalPinToPort(pin));
+
+    while ((mask >> bit) != 1) bit++;
+
+    uint16_t start = DisableInterrupts();
+
+    if (attach)
+    {
+        if (g.Mask != 0 && g.Port != port)
+        {
+            EnableInterrupts(start);
+            return false;
+        }
+
+        g.Port = port;
+        g.Sensors[bit] = this;
+        g.Last = *port;
+        g.Mask |= mask;
+        *digitalPinToPCMSK(pin) |= _BV(digitalPinToPCMSKbit(pin));
+        *digitalPinToPCICR(pin) |= _BV(group);
+    }
+    else
+    {
+        *digitalPinToPCMSK(pin) &= ~_BV(digitalPinToPCMSKbit(pin));
+        g.Mask &= ~mask;
+        g.Sensors[bit] = NULL;
+
+        if (g.Mask == 0) *digitalPinToPCICR(pin) &= ~_BV(group);
+    }
+
+    EnableInterrupts(start);
+    return true;
+#else
+    (void)attach;
+    return false;
+#endif
+}
+
+
+/*******************************************************************************
+ Timer1 input capture backend
+
+ The input capture unit latches TCNT1 into ICR1 on the rising edge of ICP1, so
+ the ISR only has to extend the captured value to a full timestamp. There is a
+ single ICP1 pin, and so a single sensor.
+*******************************************************************************/
+#if ROTATIONSENSOR_USE_ICP1
+
+static volatile RotationSensor* pCaptureSensor;
+
+
+void RotationSensor_CaptureISR()
+{
+    pCaptureSensor->Count_ISR(RotationSensorTimebase::CaptureFromISR());
+}
+
+#endif
+
+
+/*******************************************************************************
+ Burst capture
+
+ During a burst, the capture ISR stores the timestamps in burstBuffer[burstHalf]
+ instead of counting them. A full half is flagged in burstReady and the ISR
+ moves on to the other half, unless that one is still flagged (not read yet),
+ in which case the pulses are dropped until it is read. Only ReadBurst() counts
+ the pulses while burstActive is set, so the sensor state has a single writer.
+*******************************************************************************/
+#if ROTATIONSENSOR_BURST_CAPTURE
+
+// Entries left when a stopping burst hands the pulses back to the capture ISR,
+// which are counted with interrupts disabled
+static const uint8_t BURST_HANDOFF = 4;
+
+static uint32_t burstBuffer[2][ROTATIONSENSOR_BURST_SIZE];
+static volatile bool     burstActive;
+static volatile bool     burstStopping; // StopBurst() called, but pulses still buffered
+static volatile uint8_t  burstHalf;     // Half being filled
+static volatile uint8_t  burstIndex;    // Next entry of the half being filled
+static volatile uint8_t  burstReady;    // Bit mask of the full halves not read yet
+static uint8_t           burstLength[2];// Entries of each flagged half
+static volatile uint16_t burstLost;     // Pulses dropped since the last read
+
+
+static void ClearBurst()
+{
+    burstActive = false;
+    burstStopping = false;
+    burstHalf = 0;
+    burstIndex = 0;
+    burstReady = 0;
+    burstLength[0] = burstLength[1] = ROTATIONSENSOR_BURST_SIZE;
+    burstLost = 0;
+}
+
+
+static inline void BurstCapture_ISR()
+{
+    uint32_t now  = RotationSensorTimebase::CaptureFromISR();
+    uint8_t  half = burstHalf;
+
+    if (burstReady & (1 << half))
+    {
+        if (burstLost != 0xFFFF) burstLost++;
+        return;
+    }
+
+    uint8_t i = burstIndex;
+
+    burstBuffer[half][i++] = now;
+
+    if (i == ROTATIONSENSOR_BURST_SIZE)
+    {
+        i = 0;
+        burstReady |= 1 << half;
+        burstHalf = half ^ 1;
+    }
+
+    burstIndex = i;
+}
+
+#endif
+
+
+#if ROTATIONSENSOR_USE_ICP1
+
+ISR(TIMER1_CAPT_vect)
+{
+#if ROTATIONSENSOR_BURST_CAPTURE
+    if (burstActive)
+    {
+        BurstCapture_ISR();
+        return;
+    }
+#endif
+
+    RotationSensor_CaptureISR();
+}
+
+#endif
+
+
+/*******************************************************************************
+ Connects the sensor to (or disconnects it from) the Timer1 input capture unit.
+ Returns false if the input capture unit is already in use by another sensor.
+*******************************************************************************/
+bool RotationSensor::AttachCapture(bool attach)
+{
+#if ROTATIONSENSOR_USE_ICP1
+    uint16_t start = DisableInterrupts();
+
+    if (attach)
+    {
+        if (pCaptureSensor != NULL && pCaptureSensor != this)
+        {
+            EnableInterrupts(start);
+            return false;
+        }
+
+        pCaptureSensor = this;
+
+#if ROTATIONSENSOR_BURST_CAPTURE
+        ClearBurst();
+#endif
+
+#if ROTATIONSENSOR_ICP1_NOISE_CANCELER
+        TCCR1B |= _BV(ICES1) | _BV(ICNC1);
+#else
+        TCCR1B |= _BV(ICES1);
+#endif
+        TIFR1   = _BV(ICF1);
+        TIMSK1 |= _BV(ICIE1);
+    }
+    else if (pCaptureSensor == this)
+    {
+        TIMSK1 &= ~_BV(ICIE1);
+        pCaptureSensor = NULL;
+
+#if ROTATIONSENSOR_BURST_CAPTURE
+        ClearBurst();
+#endif
+    }
+
+    EnableInterrupts(start);
+    return true;
+#else
+    (void)attach;
+    return false;
+#endif
+}
+
+
+/*******************************************************************************
+ Starts a burst capture on the input capture unit.
+*******************************************************************************/
+bool RotationSensor::StartBurst()
+{
+#if ROTATIONSENSOR_BURST_CAPTURE
+    if (pCaptureSensor != this) return false;
+
+    uint16_t start = DisableInterrupts();
+    ClearBurst();
+    burstActive = true;
+    EnableInterrupts(start);
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+/*******************************************************************************
+ Ends the burst capture. The capture ISR keeps buffering the pulses until
+ ReadBurst() has drained the buffer, since counting them directly as well
+ would make two writers of the sensor state.
+*******************************************************************************/
+void RotationSensor::StopBurst()
+{
+#if ROTATIONSENSOR_BURST_CAPTURE
+    if (pCaptureSensor == this && burstActive) burstStopping = true;
+#endif
+}
+
+
+/*******************************************************************************
+ Counts the pulses of the oldest unread half of the burst buffer. With both
+ halves full, the ISR is blocked on the half it would fill next, which is the
+ older one. The ISR does not write to a flagged half, so its timestamps are
+ counted with interrupts enabled; the ISR does not count pulses during the
+ burst, so CountPulse() needs no more locking than in the ISR.
+
+ Once the burst is stopping, the half being filled is flagged as it is too,
+ with the entries so far, and the ISR goes on in the other half. Each pass
+ leaves fewer entries, as long as they are counted faster than they arrive,
+ and the last few are counted with interrupts disabled, in the same critical
+ section that hands the pulses back to the capture ISR.
+*******************************************************************************/
+uint8_t RotationSensor::ReadBurst(uint32_t times[], uint16_t* pLost)
+{
+    uint8_t n = 0;
+
+#if ROTATIONSENSOR_BURST_CAPTURE
+    uint8_t half = 0;
+    uint16_t lost = 0;
+
+    if (pCaptureSensor != this || !burstActive)
+    {
+        if (pLost != NULL) *pLost = 0;
+        return 0;
+    }
+
+    uint16_t start = DisableInterrupts();
+
+    uint8_t ready = burstReady;
+
+    lost = burstLost;
+    burstLost = 0;
+
+    if (ready == 0 && burstStopping)
+    {
+        half = burstHalf;
+        n = burstIndex;
+
+        if (n <= BURST_HANDOFF)
+        {
+            for (uint8_t i=0; i < n; i++)
+            {
+                uint32_t time = burstBuffer[half][i];
+
+                if (times != NULL) times[i] = time;
+
+                CountPulse(time);
+            }
+
+            ClearBurst();
+            EnableInterrupts(start);
+
+            if (pLost != NULL) *pLost = lost;
+            return n;
+        }
+
+        burstLength[half] = n;
+        burstReady = ready = 1 << half;
+        burstHalf = half ^ 1;
+        burstIndex = 0;
+    }
+
+    EnableInterrupts(start);
+
+    if (ready != 0)
+    {
+        half = (ready == 3) ? burstHalf : (ready >> 1);
+        n = burstLength[half];
+
+        for (uint8_t i=0; i < n; i++)
+        {
+            uint32_t time = burstBuffer[half][i];
+
+            if (times != NULL) times[i] = time;
+
+            CountPulse(time);
+        }
+
+        burstLength[half] = BURST_SIZE;
+
+        start = DisableInterrupts();
+        burstReady &= ~(1 << half);
+        EnableInterrupts(start);
+    }
+
+    if (pLost != NULL) *pLost = lost;
+#else
+    (void)times;
+    if (pLost != NULL) *pLost = 0;
+#endif
+
+    return n;
+}
+
+
+/*******************************************************************************
+ Hardware counter backends
+
+ With the Timer1 external clock, the sensor pulses clock Timer1 directly, so
+ TCNT1 is the low 16 bits of the pulse count and the overflow ISR counts the
+ high 16 bits. With the ESP32 pulse counter, PCNT unit 0 counts the rising edges
+ up to PCNT_LIMIT, where it restarts from 0 and the limit event ISR counts the
+ wraps. There is a single hardware counter, and so a single sensor, which is
+ why the gate state is not kept in the sensor object.
+*******************************************************************************/
+#if ROTATIONSENSOR_USE_T1_COUNTER || ROTATIONSENSOR_PCNT_PIN >= 0
+
+static uint32_t gateCount;      // Count at the end of the last completed gate
+static uint32_t gateTime;       // Time at the end of the last completed gate
+static uint32_t gateTicks;      // Duration of the last completed gate
+static uint32_t gatePulses;     // Pulses counted in the last completed gate
+
+
+static void ResetGate()
+{
+    gateCount = 0;
+    gateTime = RotationSensorTimebase::NowFromISR();
+    gateTicks = 0;
+    gatePulses = 0;
+}
+
+#endif
+
+
+#if ROTATIONSENSOR_USE_T1_COUNTER
+
+static volatile uint16_t counterOverflows;
+
+
+ISR(TIMER1_OVF_vect)
+{
+    counterOverflows++;
+}
+
+
+/*******************************************************************************
+ Returns the hardware pulse count. The overflow count is re-read until it is
+ unchanged across the TCNT1 read. When called with interrupts disabled, the
+ overflow ISR cannot run, so a pending overflow is accounted for instead.
+*******************************************************************************/
+static uint32_t CounterValue()
+{
+    uint16_t high;
+    uint16_t low;
+
+    do
+    {
+        high = counterOverflows;
+        low  = TCNT1;
+    }
+    while (high != counterOverflows);
+
+    if (!(SREG & _BV(SREG_I)) && (TIFR1 & _BV(TOV1)) && (low < 0x8000)) high++;
+
+    return ((uint32_t)high << 16) | low;
+}
+
+#elif ROTATIONSENSOR_PCNT_PIN >= 0
+
+static const int16_t PCNT_LIMIT = 32000;
+
+static volatile uint32_t counterWraps;
+static bool counterRunning = false;
+
+
+static void IRAM_ATTR CounterLimitISR(void*)
+{
+    counterWraps++;
+}
+
+
+/*******************************************************************************
+ Returns the hardware pulse count. The wrap count is re-read until it is
+ unchanged across the counter read.
+*******************************************************************************/
+static uint32_t CounterValue()
+{
+    uint32_t wraps;
+    int16_t  low;
+
+    do
+    {
+        wraps = counterWraps;
+        pcnt_get_counter_value(PCNT_UNIT_0, &low);
+    }
+    while (wraps != counterWraps);
+
+    return wraps * (uint32_t)PCNT_LIMIT + (uint16_t)low;
+}
+
+#endif
+
+
+/*******************************************************************************
+ Starts counting the pulses from 0 in hardware, or stops the counter.
+*******************************************************************************/
+bool RotationSensor::AttachCounter(bool attach)
+{
+#if ROTATIONSENSOR_USE_T1_COUNTER
+    uint8_t sreg = SREG;
+    cli();
+
+    TCCR1B = 0;
+
+    if (attach)
+    {
+        TCCR1A = 0;
+        TCNT1  = 0;
+        counterOverflows = 0;
+        TIFR1  = _BV(TOV1);
+        TIMSK1 = _BV(TOIE1);
+        TCCR1B = _BV(CS12) | _BV(CS11) | _BV(CS10);   // External clock on T1, rising edge
+
+        ResetGate();
+    }
+    else
+    {
+        TIMSK1 &= ~_BV(TOIE1);
+    }
+
+    SREG = sreg;
+    return true;
+#elif ROTATIONSENSOR_PCNT_PIN >= 0
+    if (attach && !counterRunning)
+    {
+        pcnt_config_t config = {};
+
+        config.pulse_gpio_num = ROTATIONSENSOR_PCNT_PIN;
+        config.ctrl_gpio_num  = PCNT_PIN_NOT_USED;
+        config.channel        = PCNT_CHANNEL_0;
+        config.unit           = PCNT_UNIT_0;
+        config.pos_mode       = PCNT_COUNT_INC;     // Rising edge
+        config.neg_mode       = PCNT_COUNT_DIS;
+        config.lctrl_mode     = PCNT_MODE_KEEP;
+        config.hctrl_mode     = PCNT_MODE_KEEP;
+        config.counter_h_lim  = PCNT_LIMIT;
+        config.counter_l_lim  = 0;
+
+        if (pcnt_unit_config(&config) != ESP_OK) return false;
+
+        // The ISR service may already be installed by other code
+        pcnt_isr_service_install(0);
+        pcnt_isr_handler_add(PCNT_UNIT_0, CounterLimitISR, NULL);
+        pcnt_event_enable(PCNT_UNIT_0, PCNT_EVT_H_LIM);
+        counterRunning = true;
+    }
+    else if (!attach)
+    {
+        if (counterRunning)
+        {
+            pcnt_counter_pause(PCNT_UNIT_0);
+            pcnt_event_disable(PCNT_UNIT_0, PCNT_EVT_H_LIM);
+            pcnt_isr_handler_remove(PCNT_UNIT_0);
+            counterRunning = false;
+        }
+
+        return true;
+    }
+
+    // Also called by Reset() with interrupts disabled, which only restarts the
+    // count of the running counter
+    pcnt_counter_pause(PCNT_UNIT_0);
+    pcnt_counter_clear(PCNT_UNIT_0);
+    counterWraps = 0;
+    ResetGate();
+    pcnt_counter_resume(PCNT_UNIT_0);
+    return true;
+#else
+    (void)attach;
+    return false;
+#endif
+}
+
+
+/*******************************************************************************
+ Returns the hardware pulse count. Since there are no pulse timestamps, the
+ interval measured is the duration of the last completed gate time (ticks) and
+ the pulses counted during it (pulses). endTime is the end of that gate.
+*******************************************************************************/
+uint32_t RotationSensor::MeasureCounter(uint32_t& endTime, uint32_t& ticks, uint32_t& pulses)
+{
+#if ROTATIONSENSOR_USE_T1_COUNTER || ROTATIONSENSOR_PCNT_PIN >= 0
+    uint32_t count = CounterValue();
+    uint32_t now   = RotationSensorTimebase::Now();
+    uint32_t gate  = now - gateTime;
+
+    if (gate >= RotationSensorTimebase::MicrosToTicks(ROTATIONSENSOR_COUNTER_GATE_MS * 1000UL))
+    {
+        gateTicks = gate;
+        gatePulses = count - gateCount;
+        gateCount = count;
+        gateTime = now;
+    }
+
+    endTime = gateTime;
+    ticks   = gateTicks;
+    pulses  = gatePulses;
+
+    return count;
+#else
+    endTime = ticks = pulses = 0;
+    return 0;
+#endif
+}
+
+
+/*******************************************************************************
+ Copies the sensors attached to an external interrupt into the sensors array,
+ in interrupt number order, and returns the number of sensors copied, up to n.
+*******************************************************************************/
+uint8_t RotationSensor::ExternalSensors(RotationSensor* sensors[], uint8_t n)
+{
+    uint8_t copied = 0;
+
+    for (uint8_t irq=0; irq < EXTERNAL_NUM_INTERRUPTS && copied < n; irq++)
+    {
+        RotationSensor* pSensor = (RotationSensor*)pSensors[irq];
+
+        if (pSensor != NULL) sensors[copied++] = pSensor;
+    }
+
+    return copied;
+}
+
+
+/*******************************************************************************
+ Logs the pulse history of every sensor attached to an external interrupt. The
+ history is copied with ReadHistory(), so it is not consumed as with
+ DrainTrace().
+*******************************************************************************/
+void RotationSensor_DebugDump()
+{
+    for (uint8_t irq=0; irq < EXTERNAL_NUM_INTERRUPTS; irq++)
+    {
+        RotationSensor* pSensor = (RotationSensor*)pSensors[irq];
+
+        if (pSensor == NULL) continue;
+
+        uint32_t times[RotationSensor::HISTORY_SIZE];
+        uint32_t count;
+        uint8_t  n = pSensor->ReadHistory(times, RotationSensor::HISTORY_SIZE, &count);
+
+        Logger(__func__) << '[' << pSensor->ID() << F("]: Index, Time, Count") << endl;
+
+        for (uint8_t i=0; i < n; i++)
+        {
+            Logger(__func__) << i << F(", ") << times[i] << F(", ") << (count - n + 1 + i) << endl;
+        }
+    }
+}
+
+
 
 
 
@@ -8,8 +8,13 @@
 
 #include <RTL_Stdlib.h>
 #include <inttypes.h>
+#include "RotationSensorConfig.h"
+#include "RotationSensorTimebase.h"
 
 
+//******************************************************************************
+/// Logs the pulse history of every sensor attached to an external interrupt.
+//******************************************************************************
 void RotationSensor_DebugDump();
 
 
@@ -23,27 +28,228 @@ class RotationSensor
 
     public: static const int NO_READING = -1;
 
+    //**************************************************************************
+    /// Type of the timebase ticks per minute divided by the pulses per
+    /// revolution, from which the RPM readings are computed. It takes 64 bits
+    /// with the CYCCNT timebase, where 60 times a core clock over 71.5MHz does
+    /// not fit in 32 bits.
+    //**************************************************************************
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_CYCCNT
+    public: typedef uint64_t RPMConstant;
+#else
+    public: typedef uint32_t RPMConstant;
+#endif
+
+    static_assert(60ULL * RotationSensorTimebase::TICKS_PER_SECOND <= (RPMConstant)-1,
+                  "The timebase ticks per minute do not fit in RotationSensor::RPMConstant");
+
+    //**************************************************************************
+    /// Number of pulse timestamps kept in the pulse history ring buffer.
+    //**************************************************************************
+    public: static const uint8_t HISTORY_SIZE = ROTATIONSENSOR_HISTORY_SIZE;
+
+    static_assert(HISTORY_SIZE >= 2 && (HISTORY_SIZE & (HISTORY_SIZE - 1)) == 0,
+                  "ROTATIONSENSOR_HISTORY_SIZE must be a power of two");
+
+    //**************************************************************************
+    /// Number of buckets of the pulse interval histogram.
+    //**************************************************************************
+    public: static const uint8_t INTERVAL_BUCKETS = ROTATIONSENSOR_INTERVAL_BUCKETS;
+
+    static_assert(INTERVAL_BUCKETS >= 16 && INTERVAL_BUCKETS <= 32,
+                  "ROTATIONSENSOR_INTERVAL_BUCKETS must be from 16 to 32");
+
+    //**************************************************************************
+    /// Number of timestamps in each half of the burst capture buffer.
+    //**************************************************************************
+    public: static const uint8_t BURST_SIZE = ROTATIONSENSOR_BURST_SIZE;
+
+    static_assert(BURST_SIZE >= 2 && BURST_SIZE <= 127,
+                  "ROTATIONSENSOR_BURST_SIZE must be from 2 to 127");
+
+    //**************************************************************************
+    /// Quadrature encoder decoding resolution, as the number of counts per
+    /// encoder cycle: 1X counts the rising edges of channel A, 2X counts both
+    /// edges of channel A, and 4X counts both edges of both channels.
+    //**************************************************************************
+    public: enum QuadratureMode
+    {
+        Quadrature1X = 1,
+        Quadrature2X = 2,
+        Quadrature4X = 4
+    };
+
+    //**************************************************************************
+    /// Sensor events, raised by the pulse ISR or by Dispatch() and delivered to
+    /// the event handler by Dispatch(). The values can be combined as a mask.
+    ///
+    ///  PulseEvent      - Every N counted pulses, as set by SetPulseEvent().
+    ///  RevolutionEvent - Every Resolution() counted pulses since the last
+    ///                    reset, i.e., on each full revolution.
+    ///  ThresholdEvent  - The pulse rate crossed the RPM threshold set by
+    ///                    SetRPMThreshold(), in either direction (see
+    ///                    AboveThreshold()).
+    ///  StallEvent      - No pulse occurred for the stall timeout (see
+    ///                    SetStallTimeout()). Raised once per stall.
+    //**************************************************************************
+    public: enum CountEvent
+    {
+        PulseEvent      = 0x01,
+        RevolutionEvent = 0x02,
+        ThresholdEvent  = 0x04,
+        StallEvent      = 0x08
+    };
+
+    //**************************************************************************
+    /// Event handler called by Dispatch() with the sensor and the event.
+    //**************************************************************************
+    public: typedef void (*EventHandler)(RotationSensor& sensor, CountEvent event);
+
+    //**************************************************************************
+    /// Sensor count data, returned by Read(). The times are in microseconds.
+    /// LastCountTime wraps around with the timebase, so only the difference of
+    /// two times is meaningful; LastCountTime64 (ROTATIONSENSOR_EXTENDED_TIME)
+    /// does not wrap. LastCountTime and LastCountTime64 are only meaningful if
+    /// Count is not 0, and LastInterval only if Valid is true. With
+    /// ROTATIONSENSOR_COMPACT, LastInterval saturates at 65535 and
+    /// CountsPerRev and SensorID share 16 bits.
+    //**************************************************************************
     public: typedef struct CountData_struct
     {
         uint32_t Count;
         uint32_t LastCountTime;
+#if ROTATIONSENSOR_COMPACT
+        uint16_t LastInterval;
+#else
         uint32_t LastInterval;
-        uint8_t  CountsPerRev;
+#endif
+#if ROTATIONSENSOR_EXTENDED_TIME
+        uint64_t LastCountTime64;   // Microseconds since the timebase started
+#endif
+#if ROTATIONSENSOR_COMPACT
+        uint16_t CountsPerRev : 10;
+        uint16_t SensorID     : 6;
+#else
+        uint16_t CountsPerRev;
         uint8_t  SensorID;
+#endif
+        bool     Valid;             // LastInterval was measured between two pulses
 
-        CountData_struct() : SensorID(0), Count(0), CountsPerRev(0), LastCountTime(0), LastInterval(0) { };
+        CountData_struct() : Count(0), LastCountTime(0), LastInterval(0),
+#if ROTATIONSENSOR_EXTENDED_TIME
+                             LastCountTime64(0),
+#endif
+                             CountsPerRev(0), SensorID(0), Valid(false) { };
 
-        int RPM() { return (LastInterval == 0) ? 0.0 : (60000000.0 / (LastInterval * CountsPerRev)); };
+        int RPM() { return (!Valid || LastInterval == 0) ? 0.0 : (60000000.0 / ((uint32_t)LastInterval * CountsPerRev)); };
 
         float Revs() { return ((float)Count) / CountsPerRev; };
     }
     CountData;
 
+    //**************************************************************************
+    /// A pulse history (trace) entry: the pulse count just after a pulse, and
+    /// the timebase timestamp of that pulse.
+    //**************************************************************************
+    public: typedef struct TraceEntry_struct
+    {
+        uint32_t Count;
+        uint32_t Time;
+    }
+    TraceEntry;
+
+    //**************************************************************************
+    /// Profiling counters of a sensor, read by ReadStats(). Cycle counts have
+    /// the resolution of RotationSensorTimebase::CYCLES_PER_PROFILE_TICK, and
+    /// the 16 bit counts saturate at 65535.
+    //**************************************************************************
+    public: typedef struct Stats_struct
+    {
+        uint32_t IsrCalls;          // Pulse ISR calls, including rejected pulses
+        uint32_t IsrTotalCycles;    // Cycles spent in the pulse ISR (saturates)
+        uint16_t IsrMinCycles;
+        uint16_t IsrMaxCycles;
+        uint16_t MaxBlockedCycles;  // Longest window with interrupts disabled by the sensor
+        uint16_t ReadRetries;       // Reads retried because a pulse occurred during the read
+        uint32_t MinPulseInterval;  // Shortest time between pulse ISR calls, in timebase ticks
+
+        Stats_struct() : IsrCalls(0), IsrTotalCycles(0), IsrMinCycles(0xFFFF), IsrMaxCycles(0),
+                         MaxBlockedCycles(0), ReadRetries(0), MinPulseInterval(0xFFFFFFFF) { };
+
+        uint16_t IsrAverageCycles() { return (IsrCalls == 0) ? 0 : IsrTotalCycles / IsrCalls; };
+
+        // Highest pulse rate observed, in pulses per second
+        uint32_t MaxPulseRate()
+        {
+            return (MinPulseInterval == 0xFFFFFFFF) ? 0 : RotationSensorTimebase::TICKS_PER_SECOND / (MinPulseInterval ? MinPulseInterval : 1);
+        };
+    }
+    Stats;
+
+    //**************************************************************************
+    /// Pulse interval statistics of a sensor, read by ReadIntervalStats(). The
+    /// intervals are in timebase ticks, between consecutive counted pulses.
+    ///
+    /// The sums are kept relative to Reference, the first interval measured,
+    /// which keeps the variance exact without a division in the ISR (the
+    /// shifted data form of the running variance). The counts saturate at
+    /// 0xFFFFFFFF.
+    //**************************************************************************
+    public: typedef struct IntervalStats_struct
+    {
+        uint32_t Intervals;         // Number of intervals measured
+        uint32_t MinInterval;
+        uint32_t MaxInterval;
+        uint32_t Reference;         // First interval measured
+        int64_t  SumDelta;          // Sum of (interval - Reference)
+        uint64_t SumSquares;        // Sum of (interval - Reference)^2
+        uint32_t Buckets[INTERVAL_BUCKETS];
+
+        IntervalStats_struct() : Intervals(0), MinInterval(0xFFFFFFFF), MaxInterval(0), Reference(0),
+                                 SumDelta(0), SumSquares(0), Buckets() { };
+
+        float Mean() { return (Intervals == 0) ? 0 : Reference + (float)SumDelta / Intervals; };
+
+        float Variance()
+        {
+            if (Intervals < 2) return 0;
+
+            float mean = (float)SumDelta / Intervals;
+
+            return ((float)SumSquares - mean * SumDelta) / (Intervals - 1);
+        };
+    }
+    IntervalStats;
+
 
     //**************************************************************************
     /// Constructor
+    ///
+    /// Pulses that occur less than minInterval microseconds after the previous
+    /// counted pulse are rejected as glitches (see ReadRejected()). The default
+    /// of 0 accepts every pulse. The threshold is kept in 32 bit timebase
+    /// ticks, so the full range of minInterval is honored with every timebase.
+    ///
+    /// The sensor is serviced by the external interrupt of the pin. A pin
+    /// without one, or whose pin or interrupt number does not fit the sensor
+    /// state (pin numbers over 255 and interrupt numbers over 127, or with
+    /// ROTATIONSENSOR_COMPACT pins over 63 and interrupts over 7), is serviced by its pin change interrupt with
+    /// ROTATIONSENSOR_USE_PCINT on AVR. Otherwise the sensor is not attached:
+    /// Enable() logs an invalid pin and Enabled() stays false.
+    //**************************************************************************
+    public: RotationSensor(int pin, int pulsesPerRev=1, uint16_t minInterval=0);
+
+    //**************************************************************************
+    /// Constructor for a quadrature encoder with channels A and B on pinA and
+    /// pinB, and pulsesPerRev encoder cycles per revolution. Requires
+    /// ROTATIONSENSOR_QUADRATURE, and both pins must have external interrupts
+    /// (only pinA for Quadrature1X and Quadrature2X).
+    ///
+    /// The count is the number of edges decoded in either direction, and the
+    /// resolution is pulsesPerRev * mode counts per revolution. ReadPosition()
+    /// returns the signed position, which increases when channel A leads B.
     //**************************************************************************
-    public: RotationSensor(int pin, int pulsesPerRev=1);
+    public: RotationSensor(int pinA, int pinB, int pulsesPerRev, QuadratureMode mode);
 
     //**************************************************************************
     /// Reset the sensor counters to 0.
@@ -62,7 +268,86 @@ class RotationSensor
     public: bool Enabled();
 
     //**************************************************************************
-    /// Returns the resolution of the sensor as pulses per revolution.
+    /// Sets the time, in milliseconds, without a pulse after which the sensor is
+    /// considered stalled and the RPM readings drop to 0. A timeout of 0 never
+    /// drops the readings to 0, but they still decay while no pulses occur.
+    /// The default is ROTATIONSENSOR_STALL_TIMEOUT_MS.
+    //**************************************************************************
+    public: void SetStallTimeout(uint16_t timeout);
+
+    //**************************************************************************
+    /// Sets the handler called by Dispatch() for the events in the events mask
+    /// (a combination of CountEvent values). A mask of 0, or a NULL handler,
+    /// disables the events. Requires ROTATIONSENSOR_EVENTS.
+    ///
+    /// Pulse, revolution and threshold events are raised by the pulse ISR, so
+    /// they are not raised for a sensor on the Timer1 counter pin (T1).
+    //**************************************************************************
+    public: void SetEventHandler(EventHandler handler, uint8_t events);
+
+    //**************************************************************************
+    /// Sets the number of counted pulses between PulseEvents, counted from this
+    /// call (and from each reset). 0 stops the PulseEvents.
+    //**************************************************************************
+    public: void SetPulseEvent(uint16_t pulses);
+
+    //**************************************************************************
+    /// Sets the RPM above and below which a ThresholdEvent is raised. The rate
+    /// is compared to the threshold on each pulse, using the last pulse
+    /// interval, and by Dispatch(), which sees the rate drop below the
+    /// threshold once the time since the last pulse is too long for it. 0
+    /// disables the threshold.
+    //**************************************************************************
+    public: void SetRPMThreshold(uint16_t rpm);
+
+    //**************************************************************************
+    /// Returns true if the pulse rate was above the RPM threshold when last
+    /// checked by the ISR or by Dispatch().
+    //**************************************************************************
+    public: bool AboveThreshold();
+
+    //**************************************************************************
+    /// Returns true if there are events waiting for Dispatch().
+    //**************************************************************************
+    public: bool EventPending();
+
+    //**************************************************************************
+    /// Delivers the events raised since the last call to the event handler, in
+    /// CountEvent order, and returns them as a mask. Call it from the main loop;
+    /// the handler runs in the caller's context, never inside the ISR. Each
+    /// kind of event is delivered once per call, however many times it was
+    /// raised since the last call. Also checks for the stall and threshold
+    /// events that are raised by the absence of pulses.
+    //**************************************************************************
+    public: uint8_t Dispatch();
+
+    //**************************************************************************
+    /// Puts the MCU to sleep until the next interrupt, in power-save mode with
+    /// the TIMER2 timebase and in power-down mode otherwise. Requires
+    /// ROTATIONSENSOR_LOW_POWER; otherwise it returns immediately.
+    ///
+    /// Sensor pulses (pin changes) wake the MCU and are counted as usual, as
+    /// does the Timer2 overflow every 256 timebase ticks. Other interrupt
+    /// sources that can wake the MCU from the sleep mode (e.g., the watchdog)
+    /// also end the sleep.
+    //**************************************************************************
+    public: static void Sleep();
+
+    //**************************************************************************
+    /// Sleeps (see Sleep()) until an event of the sensor is pending or until
+    /// timeout milliseconds have elapsed, and returns EventPending(). The
+    /// pulses that raise no event are counted without returning to the
+    /// caller, so the MCU only runs the main loop for the events. A timeout
+    /// of 0 only returns on an event.
+    ///
+    /// The timeout is measured with the timebase, so it only expires on a
+    /// wake-up: with the TIMER2 timebase within one Timer2 overflow period,
+    /// and otherwise on the next pulse, since micros() stops in power-down.
+    //**************************************************************************
+    public: bool SleepUntilEvent(uint16_t timeout=0);
+
+    //**************************************************************************
+    /// Returns the resolution of the sensor as pulses (counts) per revolution.
     //**************************************************************************
     public: int Resolution() { return _state.PulsesPerRev; };
 
@@ -85,6 +370,118 @@ class RotationSensor
     //**************************************************************************
     public: uint32_t ReadCount();
 
+    //**************************************************************************
+    /// Returns the signed position of a quadrature encoder in counts since the
+    /// last reset. For a single channel sensor this is the same as ReadCount().
+    //**************************************************************************
+    public: int32_t ReadPosition();
+
+    //**************************************************************************
+    /// Returns the direction of the last quadrature encoder count: 1 forward
+    /// (channel A leads B) or -1 reverse. Always 1 for a single channel sensor.
+    //**************************************************************************
+    public: int8_t ReadDirection();
+
+    //**************************************************************************
+    /// Copies the timestamps of the most recent sensor pulses into the times
+    /// array, oldest first. The timestamps are RotationSensorTimebase ticks,
+    /// which are microseconds with the default micros() timebase. At most n
+    /// timestamps are copied, limited by the number of pulses counted and by
+    /// HISTORY_SIZE.
+    ///
+    /// Returns the number of timestamps copied. If pCount is not NULL it receives
+    /// the pulse count that corresponds to the last timestamp copied.
+    //**************************************************************************
+    public: uint8_t ReadHistory(uint32_t times[], uint8_t n, uint32_t* pCount=NULL);
+
+    //**************************************************************************
+    /// Copies the pulse history entries recorded since the last call (or since
+    /// the last reset) into the entries array, oldest first, and returns the
+    /// number of entries copied, up to n.
+    ///
+    /// This never masks interrupts, so it can be called as often as needed to
+    /// stream the pulse timing at the full pulse rate. Entries that dropped out
+    /// of the history (HISTORY_SIZE entries) before they could be copied are
+    /// skipped; if pLost is not NULL it receives the number of entries skipped.
+    //**************************************************************************
+    public: uint8_t DrainTrace(TraceEntry entries[], uint8_t n, uint32_t* pLost=NULL);
+
+    //**************************************************************************
+    /// Returns the number of pulses rejected by the debounce filter since the
+    /// last reset. The value saturates at 65535. A count that keeps increasing
+    /// indicates a noisy sensor signal.
+    //**************************************************************************
+    public: uint16_t ReadRejected();
+
+    //**************************************************************************
+    /// Returns the profiling counters of the sensor, accumulated since it was
+    /// constructed or since the last call to ResetStats(). Requires
+    /// ROTATIONSENSOR_PROFILING; otherwise the counters are all zero.
+    ///
+    /// The ISR cycles are counted from the entry of the sensor's pulse handler
+    /// to its exit, so they do not include the interrupt vector prologue and
+    /// epilogue or the attachInterrupt() dispatch (see examples/ISRCost). Read()
+    /// and ReadCount() never disable interrupts; instead they are retried when
+    /// a pulse occurs while they read, which ReadRetries counts.
+    ///
+    /// MaxBlockedCycles is the longest window in which a method of the sensor
+    /// disabled interrupts: Reset(), Enable() and Disable(), the Set...()
+    /// methods, Dispatch(), Update(), StartBurst() and ReadBurst(), the copies
+    /// made by ReadStats(), ResetStats() and ReadIntervalStats(), and the
+    /// fallback of RotationSensorGroup::Read(). The few cycles taken by
+    /// RotationSensorTimebase::NowExtended() with ROTATIONSENSOR_EXTENDED_TIME
+    /// are not counted, since they do not belong to a sensor.
+    //**************************************************************************
+    public: Stats ReadStats();
+
+    //**************************************************************************
+    /// Clears the profiling counters of the sensor.
+    //**************************************************************************
+    public: void ResetStats();
+
+    //**************************************************************************
+    /// Returns the pulse interval statistics of the sensor, and clears them if
+    /// reset is true, so that consecutive calls summarize consecutive periods.
+    /// Requires ROTATIONSENSOR_INTERVAL_STATS; otherwise the statistics are
+    /// empty. The statistics are copied with interrupts disabled, and are not
+    /// cleared by Reset().
+    //**************************************************************************
+    public: IntervalStats ReadIntervalStats(bool reset=false);
+
+    //**************************************************************************
+    /// Starts a burst capture, for a sensor on the ICP1 input capture pin with
+    /// ROTATIONSENSOR_BURST_CAPTURE. Until StopBurst(), the capture ISR only
+    /// stores the timestamp of each pulse in one half of a double buffer, and
+    /// moves on to the other half when it is full, so it costs a fraction of
+    /// the pulse ISR. The pulses only reach the sensor when ReadBurst() hands
+    /// it a full half, so the readings lag by up to BURST_SIZE pulses, and no
+    /// events are raised for them. Returns false if the sensor is not enabled
+    /// on the input capture unit.
+    //**************************************************************************
+    public: bool StartBurst();
+
+    //**************************************************************************
+    /// Ends the burst capture. The capture ISR keeps buffering the pulses
+    /// until ReadBurst() has counted all of them, which it does in passes of
+    /// whatever has been buffered, and only then counts the pulses itself
+    /// again. The last few pulses buffered (up to 4) are counted with
+    /// interrupts disabled.
+    //**************************************************************************
+    public: void StopBurst();
+
+    //**************************************************************************
+    /// Counts the pulses of the oldest full half of the burst buffer (or once
+    /// the burst is stopping, of the partly filled half) as if they had just
+    /// occurred, and copies their timestamps to times, if not NULL, which must
+    /// have room for BURST_SIZE entries. Call it from the main loop at least
+    /// once per BURST_SIZE pulses: if both halves are full, the capture ISR
+    /// drops the new pulses, and their number since the last call is returned
+    /// in pLost. Returns the number of timestamps, or 0 if there is no full
+    /// half yet. After StopBurst(), keep calling it until it returns 0, which
+    /// means the burst has ended.
+    //**************************************************************************
+    public: uint8_t ReadBurst(uint32_t times[]=NULL, uint16_t* pLost=NULL);
+
     //**************************************************************************
     /// Returns the instantaneous sensor rotation rate as an RPM value. The sensor 
     /// should be enabled before this method is called, otherwise NO_READING is 
@@ -94,9 +491,91 @@ class RotationSensor
     /// reading is based on the time interval between pulses. So, if the sensor 
     /// is moving slowly (or not at all) then 0 will be returned until at least 
     /// 2 readings have been made.
+    ///
+    /// If no pulse has occurred for longer than the last pulse interval, the
+    /// reading is based on the time since the last pulse instead, so it decays
+    /// while the sensor slows down or stops, and it drops to 0 once the stall
+    /// timeout expires (see SetStallTimeout()).
+    ///
+    /// For a quadrature encoder the reading is negative in reverse.
     //**************************************************************************
     public: float ReadRPM();
 
+    //**************************************************************************
+    /// Returns the sensor rotation rate as an RPM value averaged over the last
+    /// windowPulses pulse intervals, or NO_READING if the sensor is not enabled.
+    ///
+    /// The average is computed from the timestamps of the first and last pulse
+    /// of the window, so it costs the same as a single interval reading. Using
+    /// a window of Resolution() pulses (one revolution) cancels out the effect
+    /// of unevenly spaced encoder slots. The window is limited to HISTORY_SIZE-1
+    /// pulses, so ROTATIONSENSOR_HISTORY_SIZE must be larger than the pulses per
+    /// revolution for a full revolution window, and to the number of pulses
+    /// that have occurred.
+    //**************************************************************************
+    public: float ReadRPM(uint8_t windowPulses);
+
+    //**************************************************************************
+    /// Returns the sensor rotation rate as an RPM value, or NO_READING if the
+    /// sensor is not enabled, switching automatically between two methods:
+    ///
+    ///  At low speed, the last pulse interval is measured (period mode), as
+    ///  for ReadRPM().
+    ///  At high speed, where the pulse intervals are short compared to the
+    ///  timestamp resolution, the pulses are counted over a gate time of at
+    ///  least ROTATIONSENSOR_AUTO_GATE_MS (frequency mode). The gate starts
+    ///  and ends on a pulse, so the count is exact and the relative error is
+    ///  the timestamp resolution over the gate time. The reading is updated
+    ///  once per gate, on the first call after it ends.
+    ///
+    /// Frequency mode is entered when the pulse interval drops below the
+    /// crossover interval (see SetAutoCrossover()), and left when it rises
+    /// above 5/4 of the crossover, so the mode does not toggle around the
+    /// crossover. Call it at least once per gate for frequency mode to track
+    /// the speed. Requires ROTATIONSENSOR_AUTO_RANGE; otherwise it is the
+    /// same as ReadRPM().
+    //**************************************************************************
+    public: float ReadRPMAuto();
+
+    //**************************************************************************
+    /// Sets the RPM above which ReadRPMAuto() switches to frequency mode. The
+    /// default of 0 crosses over at the speed where the pulse interval is 64
+    /// times the timestamp resolution, i.e., where a single interval has up to
+    /// 1.6% quantization error.
+    //**************************************************************************
+    public: void SetAutoCrossover(uint16_t rpm);
+
+    //**************************************************************************
+    /// Returns true if ReadRPMAuto() was last in frequency mode.
+    //**************************************************************************
+    public: bool AutoFrequencyMode();
+
+    //**************************************************************************
+    /// Returns the rate of change of the rotation rate, in RPM per second, or 0
+    /// if the sensor is not enabled, if fewer than ACCEL_WINDOW + 1 pulses have
+    /// occurred or if the stall timeout has expired. Requires
+    /// ROTATIONSENSOR_ACCELERATION; otherwise it always returns 0.
+    ///
+    /// The pulse intervals of the last ACCEL_WINDOW pulses are fitted with a
+    /// straight line by least squares, whose slope gives the acceleration at
+    /// the middle of the window. The sums of the fit are kept up to date by the
+    /// ISR, so a reading costs the same whatever the window. Like ReadRPM(),
+    /// the fit covers whole revolutions only if ACCEL_WINDOW is a multiple of
+    /// the pulses per revolution; otherwise uneven encoder slots add noise.
+    /// For a quadrature encoder the result is the change of the speed, the
+    /// magnitude of the rate.
+    //**************************************************************************
+    public: float ReadAcceleration();
+
+    //**************************************************************************
+    /// Number of pulse intervals fitted by ReadAcceleration().
+    //**************************************************************************
+    public: static const uint8_t ACCEL_WINDOW = HISTORY_SIZE - 1;
+
+#if ROTATIONSENSOR_ACCELERATION
+    static_assert(ACCEL_WINDOW >= 2, "ROTATIONSENSOR_ACCELERATION requires a ROTATIONSENSOR_HISTORY_SIZE of at least 4");
+#endif
+
     //**************************************************************************
     /// Returns the number of revolutions measured by the sensor since the last 
     /// reset. Since the return type is a float, fractional revolutions can be 
@@ -104,26 +583,365 @@ class RotationSensor
     //**************************************************************************
     public: float ReadRevs();
 
+    //**************************************************************************
+    /// Returns the instantaneous sensor rotation rate in RPM as a Q16.16 fixed
+    /// point value (i.e., RPM * 65536), using integer math only. The value is
+    /// computed from the full resolution of the timebase, and saturates at
+    /// 0xFFFFFFFF. Returns 0 if the sensor is not enabled or if fewer than two
+    /// pulses have occurred. The rate can be averaged over the last windowPulses
+    /// pulse intervals, as for ReadRPM(windowPulses).
+    //**************************************************************************
+    public: uint32_t ReadRPM_Q16(uint8_t windowPulses=1);
+
+    //**************************************************************************
+    /// Returns the instantaneous sensor rotation rate in thousandths of an RPM,
+    /// using integer math only. The value saturates at 0xFFFFFFFF, which is
+    /// about 4.29 million RPM (4294967.295 RPM), well above any mechanical
+    /// speed; use ReadRPM_Q16() for a finer fraction up to 65535 RPM. Returns
+    /// 0 if the sensor is not enabled or if fewer than two pulses have
+    /// occurred. The rate can be averaged over the last windowPulses pulse
+    /// intervals, as for ReadRPM(windowPulses).
+    //**************************************************************************
+    public: uint32_t ReadMilliRPM(uint8_t windowPulses=1);
+
+    //**************************************************************************
+    /// Computes ReadRPM_Q16(windowPulses) and caches it for LatestRPM_Q16().
+    /// Call it from the main loop (not from an ISR) as often as the cached
+    /// value must follow the speed, stall decay included. Does nothing without
+    /// ROTATIONSENSOR_RPM_CACHE.
+    //**************************************************************************
+    public: void Update(uint8_t windowPulses=1);
+
+    //**************************************************************************
+    /// Returns the RPM cached by the last Update() as a Q16.16 fixed point
+    /// value, or 0 before the first Update() after a reset. Only loads one 32
+    /// bit variable (8 cycles on AVR, inlined), so it can be called from time
+    /// critical ISRs. Update() stores the value with interrupts disabled, so an
+    /// ISR never sees it half written. Always 0 without ROTATIONSENSOR_RPM_CACHE.
+    //**************************************************************************
+    public: uint32_t LatestRPM_Q16() const
+    {
+#if ROTATIONSENSOR_RPM_CACHE
+        return _latestRPM;
+#else
+        return 0;
+#endif
+    };
+
+    //**************************************************************************
+    /// Returns the number of revolutions measured by the sensor since the last
+    /// reset as a Q24.8 fixed point value (i.e., revolutions * 256), using
+    /// integer math only. Returns 0 if the sensor is not enabled.
+    //**************************************************************************
+    public: uint32_t ReadRevsQ8();
+
+    //**************************************************************************
+    /// Returns num * scale / den computed with 32 bit integer math, without the
+    /// intermediate product overflowing. scale must not exceed 65536. Saturates
+    /// at 0xFFFFFFFF.
+    //**************************************************************************
+    public: static uint32_t ScaledDivide(uint32_t num, uint32_t den, uint32_t scale);
+
     /***************************************************************************
      Internal implementation
     ***************************************************************************/
-    private: void Count_ISR() volatile;
+    private: static const uint8_t HISTORY_MASK = HISTORY_SIZE - 1;
+
+    private: void Count_ISR(uint32_t now) volatile;
+
+    private: bool CountPulse(uint32_t now) volatile;
+
+    private: template<bool DEBOUNCE> void Edge_ISR(uint32_t now) volatile;
+
+    private: template<bool DEBOUNCE> bool CountEdge(uint32_t now) volatile;
+
+    private: void AccumulateTime(uint32_t count) volatile;
+
+    private: void RecordEpoch(uint32_t now) volatile;
+
+    private: void RecordInterval(uint32_t count, uint32_t now) volatile;
+
+    private: bool Quadrature_ISR(uint32_t now) volatile;
+
+    private: void Event_ISR(uint32_t now) volatile;
+
+    private: uint8_t ReadPins() volatile;
+
+    private: uint8_t BeginRead();
+
+    private: bool EndRead(uint8_t seq)
+    {
+        SeqFence();
+#if ROTATIONSENSOR_PROFILING
+        if (seq != _seq && _stats.ReadRetries != 0xFFFF) _stats.ReadRetries++;
+#endif
+        return seq == _seq;
+    };
+
+    // Orders the pulse state accesses with the sequence number for readers on
+    // another core (ESP32, RP2040). On a single core the ISR and the reader do
+    // not overlap, and the volatile accesses are already kept in order.
+    private: static inline ROTATIONSENSOR_IRAM_ATTR void SeqFence()
+    {
+#if defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_RP2040)
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+    };
+
+    // Disable and enable interrupts around a critical section of the sensor.
+    // With ROTATIONSENSOR_PROFILING the window is timed from DisableInterrupts()
+    // to EnableInterrupts(), and accounted as MaxBlockedCycles.
+    private: uint16_t DisableInterrupts()
+    {
+        noInterrupts();
+#if ROTATIONSENSOR_PROFILING
+        return RotationSensorTimebase::ProfileClock();
+#else
+        return 0;
+#endif
+    };
+
+    private: void EnableInterrupts(uint16_t start)
+    {
+#if ROTATIONSENSOR_PROFILING
+        ProfileBlocked(start);
+#else
+        (void)start;
+#endif
+        interrupts();
+    };
 
+    // Returns the timestamp of the pulse before pulse number index (from 0),
+    // given the timestamp of pulse index
+    private: ROTATIONSENSOR_IRAM_ATTR uint32_t OlderTime(uint32_t count, uint32_t index, uint32_t time) volatile
+    {
+#if ROTATIONSENSOR_COMPACT
+        // The older timestamps are extended from the low 16 bits kept in the
+        // history, so each interval before the last one must be < 65536 ticks
+        if (index == count - 1) return _prevTime;
+
+        return time - (uint16_t)((uint16_t)time - _pulseTimes[(uint8_t)(index - 1) & HISTORY_MASK]);
+#else
+        (void)count;
+        (void)time;
+        return _pulseTimes[(uint8_t)(index - 1) & HISTORY_MASK];
+#endif
+    };
+
+    // Returns the timestamp of pulse number index (from 0), which must be one of
+    // the last HISTORY_SIZE pulses
+    private: ROTATIONSENSOR_IRAM_ATTR uint32_t PulseTime(uint32_t count, uint32_t index) volatile
+    {
+#if ROTATIONSENSOR_COMPACT
+        uint32_t time = _lastTime;
+        uint32_t back = count - 1 - index;
+
+        // An index out of the history gives a wrong time, but never a walk
+        // through the whole count range
+        if (back > HISTORY_SIZE - 1) back = HISTORY_SIZE - 1;
+
+        for (uint32_t i = count - 1; back != 0; i--, back--) time = OlderTime(count, i, time);
+
+        return time;
+#else
+        (void)count;
+        return _pulseTimes[(uint8_t)index & HISTORY_MASK];
+#endif
+    };
+
+    private: ROTATIONSENSOR_IRAM_ATTR void RecordTime(uint32_t count, uint32_t now) volatile
+    {
+#if ROTATIONSENSOR_COMPACT
+        _pulseTimes[(uint8_t)count & HISTORY_MASK] = (uint16_t)now;
+        _prevTime = _lastTime;
+        _lastTime = now;
+#else
+        _pulseTimes[(uint8_t)count & HISTORY_MASK] = now;
+#endif
+    };
+
+    private: uint32_t Snapshot(uint8_t window, uint32_t& endTime, uint32_t& startTime, uint16_t* pEpoch=NULL);
+
+    private: uint32_t Elapsed(uint32_t time, uint16_t epoch);
+
+    // The pulse state behind a CountData reading
+    private: struct Sample
+    {
+        uint32_t Count;
+        uint32_t EndTime;
+        uint32_t PrevTime;
+        uint16_t Epoch;
+        int32_t  Position;
+    };
+
+    private: void CopySample(Sample& sample);
+
+    private: CountData FromSample(const Sample& sample);
+
+    private: static uint8_t ExternalSensors(RotationSensor* sensors[], uint8_t n);
+
+    private: uint32_t Measure(uint8_t window, uint32_t& ticks, uint32_t& pulses);
+
+    private: uint32_t RPMFromTicks(uint32_t ticks, uint32_t pulses, uint32_t scale);
+
+    private: uint32_t RPMToTicks(uint16_t rpm);
+
+    // The ISR is the only writer of the pulse count and the pulse history. Each
+    // update is bracketed by two increments of _seq (odd while an update is in
+    // progress), so readers can take a consistent copy without masking interrupts
+    // by retrying until _seq is even and unchanged across the copy.
     private: volatile uint32_t _count;
-    private: volatile uint32_t _lastPulseTime;
-    private: volatile uint32_t _prevPulseTime;
-    
+#if ROTATIONSENSOR_COMPACT
+    private: volatile uint16_t _pulseTimes[HISTORY_SIZE];
+    private: volatile uint32_t _lastTime;
+    private: volatile uint32_t _prevTime;
+#else
+    private: volatile uint32_t _pulseTimes[HISTORY_SIZE];
+#endif
+    private: volatile uint8_t  _seq;
+    private: uint32_t _drained;                 // Count of the last entry copied by DrainTrace()
+
+    private: RPMConstant _rpmK;                 // Timebase ticks per minute / PulsesPerRev
+
+#if ROTATIONSENSOR_AUTO_RANGE
+    private: uint32_t _crossoverTicks;          // Pulse interval at the ReadRPMAuto() crossover
+    private: uint32_t _gateCount;               // Count at the first pulse of the gate
+    private: uint32_t _gateTime;                // Time of the first pulse of the gate
+    private: float    _gateRPM;                 // RPM measured over the last gate, or < 0
+    private: bool     _frequencyMode;
+#endif
+
+#if ROTATIONSENSOR_EXTENDED_TIME
+    private: volatile uint16_t _epoch;          // Timebase wrap count of the last pulse
+#endif
+
+#if ROTATIONSENSOR_ACCELERATION
+    // Wrapping sum of the ACCEL_WINDOW timestamps before the last one
+    private: volatile uint32_t _timeSum;
+#endif
+
+#if ROTATIONSENSOR_RPM_CACHE
+    private: volatile uint32_t _latestRPM;      // Q16.16 RPM of the last Update()
+#endif
+
+#if ROTATIONSENSOR_STALL_DETECTION
+    private: uint32_t _stallTimeout;            // Stall timeout in timebase ticks, or 0
+#endif
+
+#if ROTATIONSENSOR_QUADRATURE
+    private: volatile int32_t _position;
+    private: volatile uint8_t _quadState;       // Last A/B state in bits 1/0, bit 7 set in reverse
+    private: uint8_t _pinB;
+    private: int8_t  _irqB;
+#if defined(__AVR__)
+    private: volatile uint8_t* _inputA;
+    private: volatile uint8_t* _inputB;
+    private: uint8_t _maskA;
+    private: uint8_t _maskB;
+#endif
+#endif
+
+#if ROTATIONSENSOR_EVENTS
+    private: static const uint8_t ABOVE_THRESHOLD = 0x01;
+
+    private: EventHandler _eventHandler;
+    private: uint8_t  _eventMask;
+    private: volatile uint8_t _eventFlags;      // Events raised and not yet dispatched
+    private: volatile uint8_t _eventState;      // ABOVE_THRESHOLD
+    private: uint16_t _pulseEvery;
+    private: uint16_t _pulseCountdown;          // Pulses to the next PulseEvent
+    private: uint16_t _revCountdown;            // Pulses to the next RevolutionEvent
+    private: uint32_t _thresholdTicks;          // Pulse interval at the RPM threshold, or 0
+    private: uint32_t _stallCount;              // Count when the last StallEvent was raised
+#endif
+
+#if ROTATIONSENSOR_PROFILING
+    // Only updated by the pulse ISR and with interrupts disabled, and only read
+    // with interrupts disabled, so it does not need to be volatile.
+    private: Stats _stats;
+    private: uint32_t _lastIsrTime;
+
+    private: void ProfileISR(uint16_t start, uint32_t now) volatile;
+
+    private: void ProfileBlocked(uint16_t start);
+#endif
+
+#if ROTATIONSENSOR_INTERVAL_STATS
+    // Only updated by the pulse ISR and only accessed otherwise with
+    // interrupts disabled, like _stats.
+    private: IntervalStats _intervals;
+#endif
+
+#if ROTATIONSENSOR_DEBOUNCE
+    private: uint32_t _minInterval;             // Debounce threshold in timebase ticks
+    private: volatile uint16_t _rejected;
+#endif
+
+
+    // The interrupt source that services the sensor pulses
+    private: enum Backend
+    {
+        NoBackend,
+        ExternalBackend,    // External interrupt (INTn)
+        PinChangeBackend,   // Pin change interrupt (PCINTn)
+        CaptureBackend,     // Timer1 input capture (ICP1)
+        CounterBackend      // Timer1 external clock (T1)
+    };
+
+    private: bool Attached() { return _state.Backend != NoBackend; };
+
+    private: bool Attach(bool attach);
+
+    private: void AttachExternal(bool attach);
+
+    private: void AttachExternal(int irq, int mode, bool attach);
+
+    private: bool AttachPinChange(bool attach);
+
+    private: bool AttachCapture(bool attach);
+
+    private: bool AttachCounter(bool attach);
+
+    private: uint32_t MeasureCounter(uint32_t& endTime, uint32_t& ticks, uint32_t& pulses);
+
+    private: static void SleepUnless(volatile uint8_t* pending);
+
     private: struct
     {
-        uint8_t PulsesPerRev : 8;
-        uint8_t Pin          : 5;
-        uint8_t IRQ          : 2;
-        uint8_t Enabled      : 1;
+#if ROTATIONSENSOR_COMPACT
+        uint16_t PulsesPerRev : 10;
+        uint16_t Pin          : 6;
+        int16_t  IRQ          : 4;
+        uint16_t Enabled      : 1;
+        uint16_t Backend      : 3;
+        uint16_t Quadrature   : 3;
+#else
+        uint16_t PulsesPerRev : 16;
+        uint8_t  Pin          : 8;
+        int8_t   IRQ          : 8;  // External interrupt number, or NOT_AN_INTERRUPT
+        uint8_t  Enabled      : 1;
+        uint8_t  Backend      : 3;
+        uint8_t  Quadrature   : 3;  // QuadratureMode, or 0 for a single channel sensor
+#endif
     }
     _state;
 
-    friend void RotationSensor_ISR_0();
-    friend void RotationSensor_ISR_1();
+    template<uint8_t IRQ> friend void RotationSensorISR();
+    friend void RotationSensor_PinChangeISR(uint8_t group);
+    friend void RotationSensor_CaptureISR();
+#if defined(ARDUINO_ARCH_ESP32)
+    friend void RotationSensor_ExternalISR(void* pSensor);
+    friend void RotationSensor_EdgeISR(void* pSensor);
+    friend void RotationSensor_DebouncedEdgeISR(void* pSensor);
+#endif
+    friend class RotationSensorGroup;
+    template<uint8_t PIN, uint16_t PPR, int MODE, uint16_t MIN_INTERVAL> friend class RotationSensorT;
 };
 
+#if defined(ARDUINO_ARCH_ESP32)
+// attachInterruptArg() ISRs of the RotationSensorT sensors, in IRAM
+void RotationSensor_EdgeISR(void* pSensor);
+void RotationSensor_DebouncedEdgeISR(void* pSensor);
+#endif
+
 #endif
@@ -0,0 +1,333 @@
+/*******************************************************************************
+ RotationSensorCalibration.cpp
+ Per-slot calibration of the pulse intervals of an encoder disc.
+*******************************************************************************/
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#include "RotationSensorCalibration.h"
+
+
+static const uint8_t  STORAGE_MAGIC_0 = 'R';
+static const uint8_t  STORAGE_MAGIC_1 = 'C';
+static const uint16_t FACTOR_ONE      = 1 << 14;
+
+
+/*******************************************************************************
+ Constructor
+*******************************************************************************/
+RotationSensorCalibration::RotationSensorCalibration(RotationSensor& sensor)
+    : _sensor(sensor)
+{
+    int ppr = sensor.Resolution();
+
+    _ppr = (ppr > MAX_SLOTS) ? MAX_SLOTS : ppr;
+    _offset = 0;
+    _aligned = false;
+    _mode = Idle;
+    _revolutions = 0;
+    _samples = 0;
+    _lastCount = 0;
+    _lastTime = 0;
+    Restart();
+
+    for (uint8_t i=0; i < MAX_SLOTS; i++)
+    {
+        _factor[i] = FACTOR_ONE;
+        _ratioSum[i] = 0;
+        _slotSamples[i] = 0;
+    }
+}
+
+
+/*******************************************************************************
+ Starts learning the correction factors.
+*******************************************************************************/
+void RotationSensorCalibration::Learn(uint8_t revolutions)
+{
+    Start(Learning, revolutions);
+}
+
+
+/*******************************************************************************
+ Starts aligning the table with the disc.
+*******************************************************************************/
+void RotationSensorCalibration::Align(uint8_t revolutions)
+{
+    Start(Aligning, revolutions);
+}
+
+
+void RotationSensorCalibration::Start(Mode mode, uint8_t revolutions)
+{
+    uint32_t time = 0;
+    uint32_t count;
+
+    if (_sensor.ReadHistory(&time, 1, &count) == 0) count = 0;
+
+    _mode = mode;
+    _revolutions = (revolutions == 0) ? 1 : revolutions;
+    _samples = 0;
+    _lastCount = count;
+    _lastTime = time;
+    Restart();
+
+    for (uint8_t i=0; i < MAX_SLOTS; i++)
+    {
+        _ratioSum[i] = 0;
+        _slotSamples[i] = 0;
+    }
+
+    // Every slot of the disc needs a factor, and a single slot has no error
+    if (_ppr < 2 || _sensor.Resolution() > MAX_SLOTS) _mode = Idle;
+}
+
+
+/*******************************************************************************
+ Processes the pulses since the last call. The pulses are read from the sensor
+ pulse history, so no pulse is processed twice and a gap in the counts means
+ that pulses were missed. A count that goes backwards means the sensor was
+ reset, which changes which slot the count 0 slot is, so the table is no longer
+ aligned.
+*******************************************************************************/
+bool RotationSensorCalibration::Update()
+{
+    uint32_t times[RotationSensor::HISTORY_SIZE];
+    uint32_t count;
+    uint8_t  n = _sensor.ReadHistory(times, RotationSensor::HISTORY_SIZE, &count);
+
+    if (n == 0) count = 0;
+
+    if (count < _lastCount)
+    {
+        _aligned = false;
+        _lastCount = 0;
+        Restart();
+    }
+
+    if (_mode == Idle)
+    {
+        _lastCount = count;
+        return false;
+    }
+
+    uint32_t first = count - n + 1;
+
+    for (uint8_t i=0; i < n; i++)
+    {
+        uint32_t c = first + i;
+
+        if (c <= _lastCount) continue;
+
+        if (c == _lastCount + 1 && c >= 2)
+        {
+            AddInterval(times[i] - _lastTime, c);
+        }
+        else
+        {
+            Restart();
+        }
+
+        _lastCount = c;
+        _lastTime = times[i];
+
+        if (_mode == Idle) break;
+    }
+
+    return _mode != Idle;
+}
+
+
+/*******************************************************************************
+ Drops the intervals of the revolution being measured, after missed pulses or
+ a reset of the sensor. The ratios summed so far are kept.
+*******************************************************************************/
+void RotationSensorCalibration::Restart()
+{
+    _filled = 0;
+    _revTime = 0;
+
+    for (uint8_t i=0; i < MAX_SLOTS; i++) _interval[i] = 0;
+}
+
+
+/*******************************************************************************
+ Adds the interval that ended at count to the measurement. The interval is
+ measured relative to the mean interval of the revolution that ends with it,
+ which cancels out slow changes of the speed, as a Q16 ratio.
+
+ After a restart the slots do not fill up evenly, so each slot takes at most
+ _revolutions ratios, and the measurement ends when all of them have.
+*******************************************************************************/
+void RotationSensorCalibration::AddInterval(uint32_t interval, uint32_t count)
+{
+    uint8_t slot = (uint8_t)(count % _ppr);
+
+    if (_filled < _ppr)
+    {
+        _revTime += interval;
+        _filled++;
+    }
+    else
+    {
+        _revTime += interval - _interval[slot];
+    }
+
+    _interval[slot] = interval;
+
+    if (_filled < _ppr || _revTime == 0 || _slotSamples[slot] >= _revolutions) return;
+
+    _ratioSum[slot] += RotationSensor::ScaledDivide(interval * _ppr, _revTime, 65536UL);
+    _slotSamples[slot]++;
+
+    if (++_samples >= (uint16_t)_revolutions * _ppr) Finish();
+}
+
+
+/*******************************************************************************
+ Computes the table from the measurement once all the revolutions have been
+ measured. Learning sets each factor to the inverse of the mean ratio of its
+ slot. Aligning finds the rotation of the table that minimizes the squared
+ error of the corrected ratios, which should all be 1.
+*******************************************************************************/
+void RotationSensorCalibration::Finish()
+{
+    if (_mode == Learning)
+    {
+        for (uint8_t i=0; i < _ppr; i++)
+        {
+            uint32_t mean = _ratioSum[i] / _slotSamples[i];
+            uint32_t factor = (mean == 0) ? 0xFFFF : (1UL << 30) / mean;
+
+            _factor[i] = (factor > 0xFFFF) ? 0xFFFF : (uint16_t)factor;
+        }
+
+        _offset = 0;
+    }
+    else
+    {
+        float bestError = 0;
+
+        for (uint8_t k=0; k < _ppr; k++)
+        {
+            float error = 0;
+
+            for (uint8_t i=0; i < _ppr; i++)
+            {
+                float e = (float)_ratioSum[i] / _slotSamples[i] * _factor[(i + k) % _ppr] / (1UL << 30) - 1;
+
+                error += e * e;
+            }
+
+            if (k == 0 || error < bestError)
+            {
+                bestError = error;
+                _offset = k;
+            }
+        }
+    }
+
+    _aligned = true;
+    _mode = Idle;
+}
+
+
+/*******************************************************************************
+ Writes the table to the EEPROM: the magic bytes, the pulses per revolution, the
+ factors little endian, and a checksum of the bytes after the magic bytes.
+*******************************************************************************/
+void RotationSensorCalibration::Save(int address)
+{
+    uint8_t sum = _ppr;
+
+    EEPROM.update(address++, STORAGE_MAGIC_0);
+    EEPROM.update(address++, STORAGE_MAGIC_1);
+    EEPROM.update(address++, _ppr);
+
+    for (uint8_t i=0; i < _ppr; i++)
+    {
+        uint8_t low  = (uint8_t)_factor[i];
+        uint8_t high = (uint8_t)(_factor[i] >> 8);
+
+        EEPROM.update(address++, low);
+        EEPROM.update(address++, high);
+        sum += low + high;
+    }
+
+    EEPROM.update(address, sum);
+}
+
+
+/*******************************************************************************
+ Reads the table from the EEPROM.
+*******************************************************************************/
+bool RotationSensorCalibration::Load(int address)
+{
+    if (EEPROM.read(address) != STORAGE_MAGIC_0 || EEPROM.read(address + 1) != STORAGE_MAGIC_1) return false;
+    if (EEPROM.read(address + 2) != _ppr) return false;
+
+    uint8_t sum = _ppr;
+    int     pos = address + 3;
+
+    for (uint8_t i=0; i < _ppr; i++, pos += 2)
+    {
+        sum += EEPROM.read(pos) + EEPROM.read(pos + 1);
+    }
+
+    if (EEPROM.read(pos) != sum) return false;
+
+    pos = address + 3;
+
+    for (uint8_t i=0; i < _ppr; i++, pos += 2)
+    {
+        _factor[i] = EEPROM.read(pos) | ((uint16_t)EEPROM.read(pos + 1) << 8);
+    }
+
+    _offset = 0;
+    _aligned = false;
+    return true;
+}
+
+
+/*******************************************************************************
+ Returns the correction factor of a table slot.
+*******************************************************************************/
+uint16_t RotationSensorCalibration::Factor(uint8_t slot)
+{
+    return (slot < _ppr) ? _factor[slot] : FACTOR_ONE;
+}
+
+
+/*******************************************************************************
+ Returns the interval multiplied by the factor of its slot. The multiply is
+ split at bit 14 so the product of a full 32 bit interval cannot overflow.
+*******************************************************************************/
+uint32_t RotationSensorCalibration::Correct(uint32_t interval, uint32_t count)
+{
+    if (!_aligned) return interval;
+
+    uint16_t factor = _factor[Slot(count)];
+
+    return (interval >> 14) * factor + (((interval & 0x3FFF) * factor) >> 14);
+}
+
+
+/*******************************************************************************
+ Returns the corrected instantaneous RPM.
+*******************************************************************************/
+float RotationSensorCalibration::ReadRPM()
+{
+    if (!_sensor.Enabled()) return (float)RotationSensor::NO_READING;
+
+    uint32_t times[2];
+    uint32_t count;
+
+    if (_sensor.ReadHistory(times, 2, &count) < 2) return 0;
+
+    uint32_t interval = Correct(times[1] - times[0], count);
+
+    if (interval == 0) return 0;
+
+    return (60.0 * RotationSensorTimebase::TICKS_PER_SECOND) / ((float)interval * _sensor.Resolution());
+}
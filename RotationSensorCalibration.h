@@ -0,0 +1,149 @@
+/*******************************************************************************
+ RotationSensorCalibration.h
+ Per-slot calibration of the pulse intervals of an encoder disc.
+*******************************************************************************/
+
+#ifndef _RotationSensorCalibration_h_
+#define _RotationSensorCalibration_h_
+
+#include <Arduino.h>
+#include <inttypes.h>
+#include "RotationSensor.h"
+
+
+//******************************************************************************
+/// \class RotationSensorCalibration
+/// \brief Cancels the spacing error of the slots of an encoder disc.
+///
+/// The slots of a cheap encoder disc are not evenly spaced, so the interval of
+/// each pulse has a fixed error that depends on its slot, and a single interval
+/// RPM reading is only accurate when averaged over a full revolution. The
+/// calibration learns a correction factor for each slot at a steady speed,
+/// and then corrects each interval with a table lookup and a Q2.14 multiply,
+/// so every single interval gives an accurate RPM.
+///
+/// The table is only valid while each slot of the disc is matched with its
+/// factor. Since the sensor count does not tell which slot passed first, the
+/// table is aligned by Align() after it is loaded, or after the sensor is
+/// reset, by finding the rotation of the table that best matches the
+/// intervals measured over a few revolutions.
+///
+/// The calibration only reads the sensor pulse history, so it can be used
+/// together with RotationSensorStream. It supports single channel sensors of
+/// up to MAX_SLOTS pulses per revolution. Update() must be called often enough
+/// that fewer than HISTORY_SIZE pulses occur between calls while learning or
+/// aligning; after missed pulses, the measurement resumes once a full
+/// revolution of consecutive pulses has been seen again.
+//******************************************************************************
+class RotationSensorCalibration
+{
+    //**************************************************************************
+    /// Maximum number of pulses per revolution supported.
+    //**************************************************************************
+    public: static const uint8_t MAX_SLOTS = ROTATIONSENSOR_CALIBRATION_SLOTS;
+
+    //**************************************************************************
+    /// Number of EEPROM bytes used by Save() for a sensor of ppr pulses per
+    /// revolution.
+    //**************************************************************************
+    public: static int StorageSize(uint8_t ppr) { return 4 + 2 * ppr; };
+
+    //**************************************************************************
+    /// Constructor. The table starts out as the identity (no correction) and
+    /// not aligned.
+    //**************************************************************************
+    public: RotationSensorCalibration(RotationSensor& sensor);
+
+    //**************************************************************************
+    /// Starts learning the correction factors over the given number of
+    /// revolutions. The sensor must be enabled and turning at a steady speed
+    /// until Update() returns false. The learned table is aligned.
+    //**************************************************************************
+    public: void Learn(uint8_t revolutions=16);
+
+    //**************************************************************************
+    /// Starts aligning the table with the disc over the given number of
+    /// revolutions, at any reasonably steady speed.
+    //**************************************************************************
+    public: void Align(uint8_t revolutions=4);
+
+    //**************************************************************************
+    /// Processes the pulses that occurred since the last call while learning
+    /// or aligning. Call it from the main loop. Returns true while learning or
+    /// aligning is still in progress.
+    //**************************************************************************
+    public: bool Update();
+
+    //**************************************************************************
+    /// Returns true once the table has been learned (or loaded) and aligned,
+    /// i.e., when the corrections are applied.
+    //**************************************************************************
+    public: bool Valid() { return _aligned; };
+
+    //**************************************************************************
+    /// Writes the table to the EEPROM at address, using StorageSize() bytes.
+    //**************************************************************************
+    public: void Save(int address);
+
+    //**************************************************************************
+    /// Reads the table from the EEPROM at address. Returns false, and keeps
+    /// the current table, if no valid table for the pulses per revolution of
+    /// the sensor is stored there. The loaded table must be aligned before it
+    /// is applied.
+    //**************************************************************************
+    public: bool Load(int address);
+
+    //**************************************************************************
+    /// Returns the correction factor of a slot as a Q2.14 value (16384 is 1).
+    /// Slot i is the slot of the intervals that ended at the counts c with
+    /// c % pulsesPerRev == i while the table was learned.
+    //**************************************************************************
+    public: uint16_t Factor(uint8_t slot);
+
+    //**************************************************************************
+    /// Returns a pulse interval corrected for the spacing of its slot, where
+    /// count is the sensor count just after the pulse that ends the interval.
+    /// Returns the interval unchanged if the table is not valid.
+    //**************************************************************************
+    public: uint32_t Correct(uint32_t interval, uint32_t count);
+
+    //**************************************************************************
+    /// Returns the instantaneous RPM from the last pulse interval, corrected
+    /// for the spacing of its slot. Returns 0 if fewer than two pulses have
+    /// occurred, and RotationSensor::NO_READING if the sensor is not enabled.
+    //**************************************************************************
+    public: float ReadRPM();
+
+    /***************************************************************************
+     Internal implementation
+    ***************************************************************************/
+    private: enum Mode { Idle, Learning, Aligning };
+
+    private: void Start(Mode mode, uint8_t revolutions);
+
+    private: void Restart();
+
+    private: void AddInterval(uint32_t interval, uint32_t count);
+
+    private: void Finish();
+
+    private: uint8_t Slot(uint32_t count) { return (uint8_t)((count + _offset) % _ppr); };
+
+    private: RotationSensor& _sensor;
+    private: uint8_t  _ppr;
+    private: uint8_t  _offset;                  // Table slot of the count 0 slot
+    private: bool     _aligned;
+    private: uint8_t  _mode;
+    private: uint8_t  _revolutions;             // Full revolutions to measure
+    private: uint16_t _samples;                 // Intervals measured over full revolutions
+    private: uint8_t  _filled;                  // Consecutive intervals in _interval
+    private: uint32_t _lastCount;               // Count of the last pulse processed
+    private: uint32_t _lastTime;
+    private: uint32_t _revTime;                 // Sum of _interval, one revolution
+    private: uint16_t _factor[MAX_SLOTS];       // Q2.14 correction factors
+    private: uint32_t _interval[MAX_SLOTS];     // Last interval of each count slot
+    private: uint32_t _ratioSum[MAX_SLOTS];     // Sum of interval / mean interval, Q16
+    private: uint8_t  _slotSamples[MAX_SLOTS];  // Ratios summed in _ratioSum, up to _revolutions
+};
+
+#endif
@@ -0,0 +1,371 @@
+/*******************************************************************************
+ RotationSensorConfig.h
+ Compile-time configuration for the RotationSensor library.
+
+ The Arduino IDE compiles library sources separately from the sketch, so a
+ #define placed in a sketch does not reach the library. Change the defaults
+ below, or pass the symbols as -D build flags, to configure the library.
+*******************************************************************************/
+
+#ifndef _RotationSensorConfig_h_
+#define _RotationSensorConfig_h_
+
+
+//******************************************************************************
+/// Number of pulse timestamps kept by each sensor in its pulse history ring
+/// buffer, which also serves as the pulse trace buffer drained by
+/// RotationSensor::DrainTrace(). Must be a power of two. Each entry costs 4
+/// bytes of RAM per sensor.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_HISTORY_SIZE
+#define ROTATIONSENSOR_HISTORY_SIZE 8
+#endif
+
+//******************************************************************************
+/// Set to 1 for the compact layout on RAM constrained boards (see the RAM
+/// table in README.md):
+///
+///  - The pulse history keeps the low 16 bits of each timestamp, plus the full
+///    timestamps of the last two pulses, which halves the cost of each entry.
+///    Each older timestamp is recovered from the next one, so the intervals
+///    before the last one must be below 65536 ticks (65ms with micros(), 64s
+///    with the default TIMER2 timebase) for the windowed reads and the pulse
+///    trace to be exact. The windowed RPM reads fall back to the last interval
+///    once it exceeds 32768 ticks. Cannot be combined with
+///    ROTATIONSENSOR_ACCELERATION.
+///  - CountData::LastInterval is 16 bits, saturating at 65535 microseconds.
+///  - The pulses per revolution (up to 1023) and the pin number (up to 63)
+///    are packed together, in each sensor and in CountData.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_COMPACT
+#define ROTATIONSENSOR_COMPACT 0
+#endif
+
+//******************************************************************************
+/// Set to 0 to compile out the pulse debounce filter, removing its check from
+/// the ISR and its state from each sensor. The minimum pulse interval passed to
+/// the RotationSensor constructor is then ignored.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_DEBOUNCE
+#define ROTATIONSENSOR_DEBOUNCE 1
+#endif
+
+//******************************************************************************
+/// Set to 0 to compile out stall detection. Otherwise, once the time since the
+/// last pulse exceeds the last measured pulse interval, the RPM readings decay
+/// as if a pulse had just occurred (an upper bound of the actual speed), and
+/// drop to 0 once the stall timeout expires. Evaluated when reading, so it
+/// adds nothing to the ISR.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_STALL_DETECTION
+#define ROTATIONSENSOR_STALL_DETECTION 1
+#endif
+
+//******************************************************************************
+/// Default stall timeout, in milliseconds (see RotationSensor::SetStallTimeout).
+//******************************************************************************
+#ifndef ROTATIONSENSOR_STALL_TIMEOUT_MS
+#define ROTATIONSENSOR_STALL_TIMEOUT_MS 1000
+#endif
+
+//******************************************************************************
+/// Set to 0 to compile out RotationSensor::ReadRPMAuto() and its gate state
+/// (17 bytes of RAM per sensor). Evaluated when reading, so it adds nothing to
+/// the ISR.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_AUTO_RANGE
+#define ROTATIONSENSOR_AUTO_RANGE 1
+#endif
+
+//******************************************************************************
+/// Minimum gate time, in milliseconds, over which ReadRPMAuto() counts pulses
+/// at high speed.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_AUTO_GATE_MS
+#define ROTATIONSENSOR_AUTO_GATE_MS 20
+#endif
+
+//******************************************************************************
+/// Set to 1 to support RotationSensor::ReadAcceleration(). The pulse ISR then
+/// keeps a running sum of the pulse timestamps in the history, which costs
+/// one 32 bit add and subtract per pulse.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_ACCELERATION
+#define ROTATIONSENSOR_ACCELERATION 0
+#endif
+
+//******************************************************************************
+/// Set to 1 to support RotationSensor::Update() and LatestRPM_Q16(), which
+/// cache the RPM computed in the main loop for time critical readers such as
+/// a motor control ISR (4 bytes of RAM per sensor). Adds nothing to the ISR.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_RPM_CACHE
+#define ROTATIONSENSOR_RPM_CACHE 0
+#endif
+
+//******************************************************************************
+/// Set to 1 to extend the pulse timestamps to 64 bits with a 16 bit count of
+/// the times the 32 bit timebase wrapped around (every 71.6 minutes with
+/// micros()), for CountData::LastCountTime64 and
+/// RotationSensorTimebase::NowExtended(). Stall detection then also works
+/// when a sensor stops for longer than the wrap period. The pulse ISR records
+/// the wrap count of each pulse with a 32 bit compare and no 64 bit math. The
+/// wraps are counted when the time is read, so NowExtended() must be called at
+/// least once every half wrap period; Read(), the RPM reads and Dispatch() all
+/// call it.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_EXTENDED_TIME
+#define ROTATIONSENSOR_EXTENDED_TIME 0
+#endif
+
+//******************************************************************************
+/// Maximum pulses per revolution supported by RotationSensorCalibration. Each
+/// slot costs 11 bytes of RAM per calibration object.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_CALIBRATION_SLOTS
+#define ROTATIONSENSOR_CALIBRATION_SLOTS 32
+#endif
+
+//******************************************************************************
+/// Maximum number of sensors in a RotationSensorGroup. Each sensor costs a
+/// pointer of RAM per group, and 20 bytes of stack on AVR while reading (an
+/// 18 byte pulse sample, its sequence number and a flag; 22 bytes on 32 bit
+/// cores, where the sample is padded to 20).
+//******************************************************************************
+#ifndef ROTATIONSENSOR_GROUP_SIZE
+#define ROTATIONSENSOR_GROUP_SIZE 4
+#endif
+
+//******************************************************************************
+/// Set to 0 to compile out the sensor events (see RotationSensor::Dispatch()).
+/// While no events are enabled with SetEventHandler(), they cost the pulse ISR
+/// a single test.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_EVENTS
+#define ROTATIONSENSOR_EVENTS 1
+#endif
+
+//******************************************************************************
+/// Set to 1 to support quadrature (A/B channel) encoders, which adds the
+/// quadrature decoder state to each sensor and a branch to the pulse ISR.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_QUADRATURE
+#define ROTATIONSENSOR_QUADRATURE 0
+#endif
+
+//******************************************************************************
+/// Set to 1 to service sensors on pins without an external interrupt through
+/// the pin change interrupts (PCINT). One ISR per port group services all the
+/// sensors of the group.
+///
+/// The library then defines the PCINTn_vect ISRs itself, so it cannot be used
+/// together with other libraries that define them (e.g., SoftwareSerial). All
+/// the sensors assigned to a pin change group must be on the same port, which
+/// is always the case on the ATmega328P and ATmega32U4.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_USE_PCINT
+#define ROTATIONSENSOR_USE_PCINT 0
+#endif
+
+//******************************************************************************
+/// Set to 1 to have the library define the INTn_vect ISRs itself and program
+/// the external interrupt registers directly, instead of going through
+/// attachInterrupt(). This removes the attachInterrupt() trampoline and the
+/// NULL check from every pulse. Only available on the ATmega48/88/168/328,
+/// where the Arduino interrupt numbers match the INTn numbers.
+///
+/// attachInterrupt() cannot be used for the other external interrupts in this
+/// mode, since the core's INTn_vect ISRs would conflict with the library's.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_DIRECT_ISR
+#define ROTATIONSENSOR_DIRECT_ISR 0
+#endif
+
+//******************************************************************************
+/// Selects the clock used to timestamp the sensor pulses:
+///
+///  ROTATIONSENSOR_TIMEBASE_MICROS - The Arduino micros() function (default).
+///                                   4 microsecond resolution on 16MHz boards.
+///  ROTATIONSENSOR_TIMEBASE_TIMER1 - Timer1 running free with the prescaler
+///                                   set by ROTATIONSENSOR_TIMER1_PRESCALER,
+///                                   extended to 32 bits by the overflow ISR.
+///                                   Timer1 is then not available for PWM on
+///                                   pins 9/10 or for the Servo library.
+///  ROTATIONSENSOR_TIMEBASE_TIMER2 - Timer2 clocked asynchronously by a 32768Hz
+///                                   crystal on TOSC1/TOSC2, with the prescaler
+///                                   set by ROTATIONSENSOR_TIMER2_PRESCALER. It
+///                                   keeps running in power-save mode (see
+///                                   ROTATIONSENSOR_LOW_POWER). The crystal
+///                                   takes the XTAL pins, so the MCU must run
+///                                   from its internal oscillator. Timer2 is
+///                                   then not available for PWM on pins 3/11
+///                                   or for tone().
+///  ROTATIONSENSOR_TIMEBASE_CYCCNT - The DWT cycle counter of Cortex-M3/M4/M7/
+///                                   M33 MCUs (e.g., STM32, SAMD51, Teensy),
+///                                   one tick per CPU cycle at
+///                                   ROTATIONSENSOR_CYCCNT_HZ. The 32 bit
+///                                   timestamps wrap every 2^32 cycles (36s at
+///                                   120MHz), so stall detection needs
+///                                   ROTATIONSENSOR_EXTENDED_TIME for stops
+///                                   longer than half of that.
+//******************************************************************************
+#define ROTATIONSENSOR_TIMEBASE_MICROS  0
+#define ROTATIONSENSOR_TIMEBASE_TIMER1  1
+#define ROTATIONSENSOR_TIMEBASE_TIMER2  2
+#define ROTATIONSENSOR_TIMEBASE_CYCCNT  3
+
+#ifndef ROTATIONSENSOR_TIMEBASE
+#define ROTATIONSENSOR_TIMEBASE ROTATIONSENSOR_TIMEBASE_MICROS
+#endif
+
+//******************************************************************************
+/// Set to 1 to time a sensor connected to the Timer1 input capture pin (ICP1,
+/// pin 8 on the ATmega328P, pin 4 on the ATmega32U4) with the input capture
+/// unit. The timer latches the timestamp in hardware on the edge, so interrupt
+/// latency does not affect the measured intervals. Requires the TIMER1
+/// timebase; a prescaler of 1 gives 62.5ns resolution on a 16MHz board.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_USE_ICP1
+#define ROTATIONSENSOR_USE_ICP1 0
+#endif
+
+//******************************************************************************
+/// Set to 1 to enable the input capture noise canceler, which requires the ICP1
+/// input to be stable for 4 clock cycles before an edge is captured.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_ICP1_NOISE_CANCELER
+#define ROTATIONSENSOR_ICP1_NOISE_CANCELER 1
+#endif
+
+//******************************************************************************
+/// Set to 1 to build the burst capture mode of the ICP1 sensor (see
+/// RotationSensor::StartBurst()), for logging every edge of a transient at
+/// pulse rates the pulse ISR cannot sustain. During a burst the capture ISR
+/// only stores the timestamp in a double buffer, and the main loop feeds each
+/// full half buffer to the sensor in one batch. Requires
+/// ROTATIONSENSOR_USE_ICP1; the buffer takes 8 bytes per entry.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_BURST_CAPTURE
+#define ROTATIONSENSOR_BURST_CAPTURE 0
+#endif
+
+//******************************************************************************
+/// Number of timestamps in each half of the burst capture buffer, from 2 to
+/// 127. The main loop must read a half before the other one fills, in
+/// ROTATIONSENSOR_BURST_SIZE pulse intervals.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_BURST_SIZE
+#define ROTATIONSENSOR_BURST_SIZE 32
+#endif
+
+//******************************************************************************
+/// Set to 1 to count the pulses of a sensor connected to the Timer1 external
+/// clock pin (T1, pin 5 on the ATmega328P, pin 12 on the ATmega32U4) in
+/// hardware. There is no interrupt per pulse; the only ISR is the Timer1
+/// overflow, every 65536 pulses. Since there are no pulse timestamps, Read()
+/// reports the average pulse interval over a gate time instead of the last
+/// interval. Cannot be combined with the TIMER1 timebase or with ICP1.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_USE_T1_COUNTER
+#define ROTATIONSENSOR_USE_T1_COUNTER 0
+#endif
+
+//******************************************************************************
+/// Minimum gate time, in milliseconds, over which the hardware counter mode
+/// averages the pulse interval. Longer gates give more resolution at low speed
+/// at the expense of slower updates.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_COUNTER_GATE_MS
+#define ROTATIONSENSOR_COUNTER_GATE_MS 100
+#endif
+
+//******************************************************************************
+/// Set to a GPIO number to count the pulses of a sensor on that pin with the
+/// pulse counter (PCNT) unit 0 of an ESP32, like ROTATIONSENSOR_USE_T1_COUNTER:
+/// no CPU time per pulse, and gate time averages instead of pulse intervals.
+/// The only ISR is the counter limit event, every 32000 pulses. -1 (the
+/// default) leaves the PCNT unit unused.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_PCNT_PIN
+#define ROTATIONSENSOR_PCNT_PIN -1
+#endif
+
+//******************************************************************************
+/// Clock rate of the CYCCNT timebase, in Hz: the CPU clock. It must be set to
+/// a number with the CYCCNT timebase (e.g., 120000000), since the timebase
+/// constants are computed at compile time, and F_CPU is a runtime variable
+/// (SystemCoreClock) on STM32duino and other Cortex-M cores.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_CYCCNT_HZ
+#define ROTATIONSENSOR_CYCCNT_HZ 0
+#endif
+
+//******************************************************************************
+/// Timer1 prescaler for ROTATIONSENSOR_TIMEBASE_TIMER1 (1, 8 or 64). With a
+/// 16MHz clock a prescaler of 8 gives 0.5 microsecond ticks and a 32 bit
+/// timestamp range of about 35 minutes.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_TIMER1_PRESCALER
+#define ROTATIONSENSOR_TIMER1_PRESCALER 8
+#endif
+
+//******************************************************************************
+/// Timer2 prescaler for ROTATIONSENSOR_TIMEBASE_TIMER2 (1, 8, 32, 64 or 128).
+/// Timer2 overflows, and wakes the MCU, every 256 ticks. The default of 32
+/// gives 1024 ticks per second (0.98ms resolution) and 4 wake-ups per second.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_TIMER2_PRESCALER
+#define ROTATIONSENSOR_TIMER2_PRESCALER 32
+#endif
+
+//******************************************************************************
+/// Set to 1 for sensors that must keep counting while the MCU sleeps (see
+/// RotationSensor::Sleep()). The INTn edge interrupts cannot wake the MCU from
+/// power-save or power-down mode, but pin changes can, so every single channel
+/// sensor is then serviced through the pin change interrupts, which requires
+/// ROTATIONSENSOR_USE_PCINT. With the TIMER2 timebase the MCU sleeps in
+/// power-save mode and the pulse timing stays accurate. Otherwise it sleeps in
+/// power-down mode, where the micros() clock stops: the counts stay accurate,
+/// but the pulse intervals that span a sleep do not.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_LOW_POWER
+#define ROTATIONSENSOR_LOW_POWER 0
+#endif
+
+//******************************************************************************
+/// Set to 1 to build the profiling instrumentation read by
+/// RotationSensor::ReadStats(): the CPU cycles spent in the pulse ISR, the
+/// longest window with interrupts disabled, the read retries and the highest
+/// pulse rate. The cycles are counted with Timer1. With the TIMER1 timebase its
+/// counter is used as is, with the resolution of the prescaler; otherwise
+/// Timer1 is started at the CPU clock rate, so it is not available for PWM on
+/// pins 9/10 or for the Servo library. AVR only, and cannot be combined with
+/// ROTATIONSENSOR_USE_T1_COUNTER.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_PROFILING
+#define ROTATIONSENSOR_PROFILING 0
+#endif
+
+//******************************************************************************
+/// Set to 1 to collect the pulse interval statistics read by
+/// RotationSensor::ReadIntervalStats(): a log2 histogram of the intervals and
+/// their minimum, maximum, mean and variance. Costs the pulse ISR a bucket
+/// lookup, a few compares, a 16x16 bit multiply and a 64 bit add per pulse,
+/// and each sensor 32 bytes of RAM plus 4 bytes per bucket. Intervals that
+/// differ from the first one by 65536 ticks or more take a 64 bit multiply,
+/// which is a library call on AVR.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_INTERVAL_STATS
+#define ROTATIONSENSOR_INTERVAL_STATS 0
+#endif
+
+//******************************************************************************
+/// Number of buckets of the interval histogram, from 16 to 32. Bucket i counts
+/// the intervals from 2^i to 2^(i+1)-1 timebase ticks (bucket 0 also counts 0),
+/// and the last bucket also counts all the longer intervals.
+//******************************************************************************
+#ifndef ROTATIONSENSOR_INTERVAL_BUCKETS
+#define ROTATIONSENSOR_INTERVAL_BUCKETS 16
+#endif
+
+#endif
@@ -0,0 +1,175 @@
+/*******************************************************************************
+ RotationSensorGroup.cpp
+ Coherent snapshot of the count data of several rotation sensors.
+*******************************************************************************/
+
+#include <Arduino.h>
+
+#include "RotationSensorGroup.h"
+
+
+// Lock free passes before the snapshot is taken with interrupts disabled
+static const uint8_t MAX_PASSES = 3;
+
+
+/*******************************************************************************
+ Constructor
+*******************************************************************************/
+RotationSensorGroup::RotationSensorGroup()
+{
+    _size = 0;
+}
+
+
+/*******************************************************************************
+ Adds a sensor to the group.
+*******************************************************************************/
+bool RotationSensorGroup::Add(RotationSensor& sensor)
+{
+    if (_size >= MAX_SENSORS || Contains(&sensor)) return false;
+
+    _sensors[_size++] = &sensor;
+    return true;
+}
+
+
+/*******************************************************************************
+ Adds the sensors attached to an external interrupt.
+*******************************************************************************/
+uint8_t RotationSensorGroup::AddAttached()
+{
+    RotationSensor* sensors[MAX_SENSORS];
+    uint8_t n = RotationSensor::ExternalSensors(sensors, MAX_SENSORS);
+    uint8_t added = 0;
+
+    for (uint8_t i=0; i < n; i++)
+    {
+        if (Add(*sensors[i])) added++;
+    }
+
+    return added;
+}
+
+
+bool RotationSensorGroup::Contains(RotationSensor* pSensor)
+{
+    for (uint8_t i=0; i < _size; i++)
+    {
+        if (_sensors[i] == pSensor) return true;
+    }
+
+    return false;
+}
+
+
+/*******************************************************************************
+ Copies the pulse state of all the sensors at a single instant, and returns
+ that instant in timebase ticks. sampled receives which sensors were copied:
+ the sensors with a hardware counter have no pulse state to copy.
+
+ The sequence numbers of all the sensors are taken before any of the pulse
+ state is copied, and checked after all of it is, so if none of them changed,
+ no sensor recorded a pulse from the first copy to the last: the copies all
+ hold at any instant in between, such as the timestamp taken with them. The
+ copies are only converted after the snapshot, to keep the pass short.
+*******************************************************************************/
+uint32_t RotationSensorGroup::Snapshot(RotationSensor::Sample samples[], bool sampled[])
+{
+    uint8_t  seqs[MAX_SENSORS];
+    uint32_t now = 0;
+    bool     consistent = false;
+
+    for (uint8_t i=0; i < _size; i++)
+    {
+        RotationSensor* pSensor = _sensors[i];
+
+        sampled[i] = pSensor->Enabled() && pSensor->_state.Backend != RotationSensor::CounterBackend;
+    }
+
+    for (uint8_t pass=0; pass < MAX_PASSES && !consistent; pass++)
+    {
+        for (uint8_t i=0; i < _size; i++)
+        {
+            if (sampled[i]) seqs[i] = _sensors[i]->BeginRead();
+        }
+
+        for (uint8_t i=0; i < _size; i++)
+        {
+            if (sampled[i]) _sensors[i]->CopySample(samples[i]);
+        }
+
+        now = RotationSensorTimebase::Now();
+        consistent = true;
+
+        for (uint8_t i=0; i < _size; i++)
+        {
+            if (sampled[i] && !_sensors[i]->EndRead(seqs[i])) consistent = false;
+        }
+    }
+
+    if (!consistent)
+    {
+        noInterrupts();
+#if ROTATIONSENSOR_PROFILING
+        uint16_t start = RotationSensorTimebase::ProfileClock();
+#endif
+
+        for (uint8_t i=0; i < _size; i++)
+        {
+            if (sampled[i]) _sensors[i]->CopySample(samples[i]);
+        }
+
+        now = RotationSensorTimebase::NowFromISR();
+
+#if ROTATIONSENSOR_PROFILING
+        // Each sensor was blocked for the whole window
+        for (uint8_t i=0; i < _size; i++)
+        {
+            if (sampled[i]) _sensors[i]->ProfileBlocked(start);
+        }
+#endif
+        interrupts();
+    }
+
+    return now;
+}
+
+
+/*******************************************************************************
+ Reads the count data of all the sensors at a single instant.
+*******************************************************************************/
+uint8_t RotationSensorGroup::Read(RotationSensor::CountData data[], uint32_t* pTime)
+{
+    RotationSensor::Sample samples[MAX_SENSORS];
+    bool     sampled[MAX_SENSORS];
+    uint32_t now = Snapshot(samples, sampled);
+
+    for (uint8_t i=0; i < _size; i++)
+    {
+        data[i] = sampled[i] ? _sensors[i]->FromSample(samples[i]) : _sensors[i]->Read();
+    }
+
+    if (pTime != NULL) *pTime = RotationSensorTimebase::TicksToMicros(now);
+
+    return _size;
+}
+
+
+/*******************************************************************************
+ Reads the positions of all the sensors at a single instant.
+*******************************************************************************/
+uint8_t RotationSensorGroup::ReadPositions(int32_t positions[], uint32_t* pTime)
+{
+    RotationSensor::Sample samples[MAX_SENSORS];
+    bool     sampled[MAX_SENSORS];
+    uint32_t now = Snapshot(samples, sampled);
+
+    for (uint8_t i=0; i < _size; i++)
+    {
+        positions[i] = sampled[i] ? samples[i].Position : _sensors[i]->ReadPosition();
+    }
+
+    if (pTime != NULL) *pTime = RotationSensorTimebase::TicksToMicros(now);
+
+    return _size;
+}
@@ -0,0 +1,89 @@
+/*******************************************************************************
+ RotationSensorGroup.h
+ Coherent snapshot of the count data of several rotation sensors.
+*******************************************************************************/
+
+#ifndef _RotationSensorGroup_h_
+#define _RotationSensorGroup_h_
+
+#include <Arduino.h>
+#include <inttypes.h>
+#include "RotationSensor.h"
+
+
+//******************************************************************************
+/// \class RotationSensorGroup
+/// \brief Reads the count data of several sensors at the same instant.
+///
+/// Calling Read() on each sensor in turn gives readings that are skewed in
+/// time, since pulses keep occurring between the reads, e.g., the left and
+/// right wheel counts of a differential drive robot then disagree, which
+/// shows up as heading error. Read() on a group copies the pulse state of
+/// all its sensors in one pass, and only keeps the copy if no sensor recorded
+/// a pulse during the pass, so the readings all hold at a single instant.
+///
+/// Like RotationSensor::Read(), this does not mask interrupts. Only if a
+/// pulse lands in every one of several passes, at very high pulse rates, is
+/// the copy made with interrupts disabled, for a few microseconds per sensor.
+/// Sensors using a hardware counter (ROTATIONSENSOR_USE_T1_COUNTER or
+/// ROTATIONSENSOR_PCNT_PIN) have no per pulse state, so they are read after
+/// the snapshot, with their gate time averages.
+//******************************************************************************
+class RotationSensorGroup
+{
+    //**************************************************************************
+    /// Maximum number of sensors in a group.
+    //**************************************************************************
+    public: static const uint8_t MAX_SENSORS = ROTATIONSENSOR_GROUP_SIZE;
+
+    //**************************************************************************
+    /// Constructor. The group starts out empty.
+    //**************************************************************************
+    public: RotationSensorGroup();
+
+    //**************************************************************************
+    /// Adds a sensor to the group. Returns false if the group is full or the
+    /// sensor is already in it.
+    //**************************************************************************
+    public: bool Add(RotationSensor& sensor);
+
+    //**************************************************************************
+    /// Adds every enabled sensor attached to an external interrupt, in
+    /// interrupt number order, as far as the group has room. Returns the
+    /// number of sensors added.
+    //**************************************************************************
+    public: uint8_t AddAttached();
+
+    //**************************************************************************
+    /// Returns the number of sensors in the group.
+    //**************************************************************************
+    public: uint8_t Size() { return _size; };
+
+    //**************************************************************************
+    /// Fills the data array, in the order the sensors were added, with the
+    /// count data of every sensor of the group as it was at a single instant,
+    /// and returns the number of sensors read. If pTime is not NULL it receives
+    /// that instant, in microseconds, on the same clock as LastCountTime.
+    //**************************************************************************
+    public: uint8_t Read(RotationSensor::CountData data[], uint32_t* pTime=NULL);
+
+    //**************************************************************************
+    /// Fills the positions array, in the order the sensors were added, with
+    /// the signed position of every sensor of the group (see
+    /// RotationSensor::ReadPosition()) as it was at a single instant, and
+    /// returns the number of sensors read.
+    //**************************************************************************
+    public: uint8_t ReadPositions(int32_t positions[], uint32_t* pTime=NULL);
+
+    /***************************************************************************
+     Internal implementation
+    ***************************************************************************/
+    private: bool Contains(RotationSensor* pSensor);
+
+    private: uint32_t Snapshot(RotationSensor::Sample samples[], bool sampled[]);
+
+    private: RotationSensor* _sensors[MAX_SENSORS];
+    private: uint8_t _size;
+};
+
+#endif
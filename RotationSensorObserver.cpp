@@ -0,0 +1,180 @@
+/*******************************************************************************
+ RotationSensorObserver.cpp
+ Alpha-beta observer of the pulse period of a rotation sensor.
+*******************************************************************************/
+
+#include <Arduino.h>
+#include <math.h>
+
+#include "RotationSensorObserver.h"
+
+
+static const uint8_t  FRACTION_BITS = RotationSensorObserver::FRACTION_BITS;
+
+// Longest fixed point period tracked. With the error kept within the same
+// range, the prediction error of a step fits in 32 bits.
+static const uint32_t MAX_PERIOD = 1UL << 30;
+static const int32_t  MAX_ERROR  = (int32_t)MAX_PERIOD - 1;
+
+// Largest gain shift, for 2 * shift to stay a valid shift of 32 bits
+static const uint8_t MAX_SHIFT = 15;
+
+
+/*******************************************************************************
+ Constructor
+*******************************************************************************/
+RotationSensorObserver::RotationSensorObserver(RotationSensor& sensor, float revolutions)
+    : _sensor(sensor)
+{
+    _rpmK = (60.0 * (1UL << FRACTION_BITS) * RotationSensorTimebase::TICKS_PER_SECOND) / sensor.Resolution();
+
+    SetResponse(revolutions);
+    Reset();
+}
+
+
+/*******************************************************************************
+ Sets the response time. The gains of a critically damped alpha-beta filter
+ follow from its discount factor d: alpha = 1 - d^2 and beta = (1 - d)^2. It
+ settles to 90% of a step in about 5 time constants of -1 / ln(d) steps.
+
+ With d = 1 - 2^-shift, beta = 2^-2shift and alpha = 2^(1-shift) - beta, and
+ the time constant is close to 2^shift steps.
+*******************************************************************************/
+void RotationSensorObserver::SetResponse(float revolutions)
+{
+    float pulses = revolutions * _sensor.Resolution();
+
+    _shift = 0;
+    while (_shift < MAX_SHIFT && 5.0f * (2UL << _shift) <= pulses) _shift++;
+}
+
+
+/*******************************************************************************
+ Restarts the observer.
+*******************************************************************************/
+void RotationSensorObserver::Reset()
+{
+    _tracking = Idle;
+    _lastCount = 0;
+    _lastTime = 0;
+    _error = 0;
+    _period = 0;
+}
+
+
+/*******************************************************************************
+ Steps the observer with the new pulses in the sensor pulse history. A count
+ that goes backwards means the sensor was reset.
+*******************************************************************************/
+bool RotationSensorObserver::Update()
+{
+    uint32_t times[RotationSensor::HISTORY_SIZE];
+    uint32_t count;
+    uint8_t  n = _sensor.ReadHistory(times, RotationSensor::HISTORY_SIZE, &count);
+
+    if (n == 0 || count < _lastCount) Reset();
+
+    uint32_t first = count - n + 1;
+    bool     updated = false;
+
+    for (uint8_t i=0; i < n; i++)
+    {
+        if (first + i <= _lastCount && _tracking != Idle) continue;
+
+        Step(first + i, times[i]);
+        updated = true;
+    }
+
+    return updated;
+}
+
+
+/*******************************************************************************
+ Returns the fixed point time of a number of periods, or 0 if it is over
+ MAX_PERIOD.
+ Only a step over several pulses takes the multiply.
+*******************************************************************************/
+static uint32_t Due(uint32_t period, uint32_t pulses)
+{
+    if (pulses == 1) return period;
+
+    return (pulses != 0 && pulses <= MAX_PERIOD / period) ? period * pulses : 0;
+}
+
+
+/*******************************************************************************
+ Steps the observer with a pulse. The pulse was predicted at the last pulse
+ time plus the error of that estimate plus one period for each pulse since,
+ and the prediction error r corrects the estimate of its time by alpha * r and
+ the period by beta * r (spread over the pulses since the last one). The new
+ error is that of the corrected estimate relative to the pulse, -(1 - alpha) r.
+
+ The interval and the period are bounded by MAX_PERIOD in fixed point, and the
+ error by MAX_ERROR, so r is within +-2^31 and is computed modulo 2^32. The
+ corrections are arranged so that no intermediate exceeds r. The shifts of the
+ signed values are arithmetic, as with GCC on every target.
+*******************************************************************************/
+void RotationSensorObserver::Step(uint32_t count, uint32_t time)
+{
+    uint32_t pulses   = count - _lastCount;
+    uint32_t interval = time - _lastTime;
+    uint32_t measured = interval << FRACTION_BITS;
+    uint32_t due      = (_tracking == Tracking) ? Due(_period, pulses) : 0;
+
+    if (due != 0 && interval <= MAX_INTERVAL && measured / LATE_PERIODS <= due)
+    {
+        int32_t r          = (int32_t)(measured - due - (uint32_t)_error);
+        int32_t periodStep = r >> (2 * _shift);                              // beta * r
+        int32_t error      = ((r >> _shift) - periodStep) - (r - (r >> _shift)); // alpha * r - r
+
+        if (pulses != 1) periodStep /= (int32_t)pulses;
+
+        uint32_t period = (periodStep >= 0) ? _period + (uint32_t)periodStep : _period - (0U - (uint32_t)periodStep);
+
+        _error  = (error < -MAX_ERROR) ? -MAX_ERROR : (error > MAX_ERROR) ? MAX_ERROR : error;
+
+        if (periodStep < 0 && (0U - (uint32_t)periodStep) >= _period) period = 1;
+
+        _period = (period > MAX_PERIOD) ? MAX_PERIOD : period;
+    }
+    else if (_tracking == FirstPulse && interval <= MAX_INTERVAL && pulses != 0)
+    {
+        _period = (pulses == 1) ? measured : measured / pulses;
+        if (_period == 0) _period = 1;
+        _error = 0;
+        _tracking = Tracking;
+    }
+    else
+    {
+        // First pulse, or a pulse after a stop
+        _tracking = FirstPulse;
+    }
+
+    _lastCount = count;
+    _lastTime = time;
+}
+
+
+/*******************************************************************************
+ Returns the estimated RPM. The next pulse is due at the period plus the error
+ after the last one; while it is late, the period is taken as the time from
+ the estimated time of the last pulse to now.
+*******************************************************************************/
+float RotationSensorObserver::ReadRPM()
+{
+    if (!_sensor.Enabled()) return (float)RotationSensor::NO_READING;
+
+    Update();
+
+    if (_tracking != Tracking) return 0;
+
+    uint32_t elapsed = RotationSensorTimebase::Now() - _lastTime;
+
+    if (elapsed > MAX_INTERVAL || (elapsed << FRACTION_BITS) / LATE_PERIODS > _period) return 0;
+
+    int32_t  late   = (int32_t)((elapsed << FRACTION_BITS) - (uint32_t)_error);
+    uint32_t period = (late > (int32_t)_period) ? (uint32_t)late : _period;
+
+    return _rpmK / period * _sensor.ReadDirection();
+}
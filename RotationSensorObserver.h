@@ -0,0 +1,131 @@
+/*******************************************************************************
+ RotationSensorObserver.h
+ Alpha-beta observer of the pulse period of a rotation sensor.
+*******************************************************************************/
+
+#ifndef _RotationSensorObserver_h_
+#define _RotationSensorObserver_h_
+
+#include <Arduino.h>
+#include <inttypes.h>
+#include "RotationSensor.h"
+
+
+//******************************************************************************
+/// \class RotationSensorObserver
+/// \brief Low latency, low noise speed estimate from the pulse timestamps.
+///
+/// The windowed RPM reads of RotationSensor average over more pulses to reduce
+/// the noise, which delays the reading by half the window. The observer
+/// instead tracks the time of the next pulse and the pulse period with an
+/// alpha-beta filter, stepped once per pulse: each pulse corrects the
+/// predicted pulse time by a fraction alpha of the prediction error, and the
+/// period by a fraction beta. The gains are powers of two chosen once from
+/// the response time, and the state is kept in 32 bit fixed point, so a step
+/// only takes shifts and adds; only a step over several pulses, when pulses
+/// were missed, takes a multiply and a divide.
+///
+/// Between pulses, the estimate is held until the next pulse is due; once it
+/// is late, the period is extended to the time since the prediction, so the
+/// reading drops as soon as the sensor slows down, rather than at the next
+/// pulse. A pulse more than LATE_PERIODS periods late (the sensor stopped),
+/// or more than MAX_INTERVAL ticks after the previous one, restarts the
+/// observer, and the reading is 0 until then.
+///
+/// Like RotationSensorCalibration, the observer reads the sensor pulse
+/// history, so Update() (or ReadRPM()) must be called often enough that fewer
+/// than HISTORY_SIZE pulses occur between calls; the missed pulses are stepped
+/// over as a single longer step.
+//******************************************************************************
+class RotationSensorObserver
+{
+    //**************************************************************************
+    /// Number of periods after which a missing pulse is taken as a stop.
+    //**************************************************************************
+    public: static const uint8_t LATE_PERIODS = 8;
+
+    //**************************************************************************
+    /// Number of fraction bits of the periods and times kept by the observer,
+    /// from 8 down to 0 for the faster timebases, so that a second in fixed
+    /// point fits in 30 bits.
+    //**************************************************************************
+    public: static const uint8_t FRACTION_BITS =
+        (RotationSensorTimebase::TICKS_PER_SECOND <= (1UL << 22)) ? 8 :
+        (RotationSensorTimebase::TICKS_PER_SECOND <= (1UL << 23)) ? 7 :
+        (RotationSensorTimebase::TICKS_PER_SECOND <= (1UL << 24)) ? 6 :
+        (RotationSensorTimebase::TICKS_PER_SECOND <= (1UL << 25)) ? 5 :
+        (RotationSensorTimebase::TICKS_PER_SECOND <= (1UL << 26)) ? 4 :
+        (RotationSensorTimebase::TICKS_PER_SECOND <= (1UL << 27)) ? 3 :
+        (RotationSensorTimebase::TICKS_PER_SECOND <= (1UL << 28)) ? 2 :
+        (RotationSensorTimebase::TICKS_PER_SECOND <= (1UL << 29)) ? 1 : 0;
+
+    //**************************************************************************
+    /// Longest pulse interval tracked, in timebase ticks: 2^30 fixed point
+    /// ticks, which is at least 1 s with every timebase, about 4.2 s with the
+    /// micros() timebase, 2.1 s with TIMER1 at 2MHz and 1.05 s at 16MHz, and
+    /// 1.1 s with CYCCNT at 120MHz. A 20 pulse per revolution sensor reads down
+    /// to 3 RPM or less.
+    //**************************************************************************
+    public: static const uint32_t MAX_INTERVAL = (1UL << 30) >> FRACTION_BITS;
+
+    static_assert(RotationSensorTimebase::TICKS_PER_SECOND <= (1UL << 30),
+                  "RotationSensorObserver needs a timebase of at most 2^30 ticks per second");
+
+    //**************************************************************************
+    /// Constructor. See SetResponse().
+    //**************************************************************************
+    public: RotationSensorObserver(RotationSensor& sensor, float revolutions=1);
+
+    //**************************************************************************
+    /// Sets the response time of the observer, in revolutions of the sensor:
+    /// the observer is critically damped, and settles to 90% of a step of the
+    /// speed in about that many revolutions. Shorter responses track the speed
+    /// faster, and filter the pulse jitter less. The response is rounded down
+    /// to 5 times a power of two pulses, so that the gains are shifts; below
+    /// 10 pulses, each pulse sets the period directly.
+    //**************************************************************************
+    public: void SetResponse(float revolutions);
+
+    //**************************************************************************
+    /// Steps the observer with the pulses that occurred since the last call.
+    /// Returns true if there were any.
+    //**************************************************************************
+    public: bool Update();
+
+    //**************************************************************************
+    /// Returns the estimated RPM, after an Update(). Negative in reverse for a
+    /// quadrature encoder. Returns 0 until two pulses have been observed, and
+    /// RotationSensor::NO_READING if the sensor is not enabled.
+    //**************************************************************************
+    public: float ReadRPM();
+
+    //**************************************************************************
+    /// Returns the estimated pulse period in timebase ticks, or 0 until two
+    /// pulses have been observed. It does not include the extension while a
+    /// pulse is late.
+    //**************************************************************************
+    public: uint32_t Period() { return (_tracking == Tracking) ? _period >> FRACTION_BITS : 0; };
+
+    //**************************************************************************
+    /// Restarts the observer from the pulses in the sensor history.
+    //**************************************************************************
+    public: void Reset();
+
+    /***************************************************************************
+     Internal implementation
+    ***************************************************************************/
+    private: enum State { Idle, FirstPulse, Tracking };
+
+    private: void Step(uint32_t count, uint32_t time);
+
+    private: RotationSensor& _sensor;
+    private: float    _rpmK;                    // Fixed point ticks per minute / pulses per revolution
+    private: uint8_t  _shift;                   // Gains: beta = 2^-2shift, alpha = 2^(1-shift) - beta
+    private: uint8_t  _tracking;
+    private: uint32_t _lastCount;               // Count of the last pulse stepped
+    private: uint32_t _lastTime;
+    private: int32_t  _error;                   // Estimated minus measured time of the last pulse
+    private: uint32_t _period;                  // Estimated pulse period, in FRACTION_BITS fixed point
+};
+
+#endif
@@ -0,0 +1,97 @@
+/*******************************************************************************
+ RotationSensorOdometry.cpp
+ Distance and linear velocity of a wheel driven through a rotation sensor.
+*******************************************************************************/
+
+#include <Arduino.h>
+
+#include "RotationSensorOdometry.h"
+
+
+// Converts a value to Q16, saturated to the int32_t range
+static int32_t ToQ16(float value)
+{
+    float q = value * 65536.0f;
+
+    if (q >= 2147483647.0f) return 0x7FFFFFFFL;
+    if (q <= -2147483647.0f) return -0x7FFFFFFFL;
+
+    return (int32_t)(q + ((q < 0) ? -0.5f : 0.5f));
+}
+
+
+/*******************************************************************************
+ Constructor
+*******************************************************************************/
+RotationSensorOdometry::RotationSensorOdometry(RotationSensor& sensor, float circumference, float gearRatio)
+    : _sensor(sensor)
+{
+    if (gearRatio == 0) gearRatio = 1;
+
+    _distancePerCount = ToQ16(circumference / (gearRatio * sensor.Resolution()));
+    _velocityPerRPM   = ToQ16(circumference / (gearRatio * 60));
+    _lastDistance = 0;
+}
+
+
+/*******************************************************************************
+ Returns the distance of a number of counts. The product needs 64 bits for a
+ large count with a distance per count over 1.
+*******************************************************************************/
+int32_t RotationSensorOdometry::CountsToDistance(int32_t counts)
+{
+    return (int32_t)(((int64_t)counts * _distancePerCount) >> 16);
+}
+
+
+/*******************************************************************************
+ Returns the distance covered since the sensor was reset.
+*******************************************************************************/
+int32_t RotationSensorOdometry::Distance()
+{
+    return CountsToDistance(_sensor.ReadPosition());
+}
+
+
+/*******************************************************************************
+ Returns the distance covered since the last call.
+*******************************************************************************/
+int32_t RotationSensorOdometry::Delta()
+{
+    return Delta(_sensor.ReadPosition());
+}
+
+
+/*******************************************************************************
+ Returns the distance covered up to a sensor position since the last call.
+*******************************************************************************/
+int32_t RotationSensorOdometry::Delta(int32_t position)
+{
+    int32_t distance = CountsToDistance(position);
+    int32_t delta = distance - _lastDistance;
+
+    _lastDistance = distance;
+    return delta;
+}
+
+
+/*******************************************************************************
+ Returns the linear velocity: the Q16 RPM times the Q16 velocity per RPM is a
+ Q32 value.
+*******************************************************************************/
+int32_t RotationSensorOdometry::Velocity(uint8_t windowPulses)
+{
+    uint32_t rpm = _sensor.ReadRPM_Q16(windowPulses);
+    int64_t  velocity = ((int64_t)rpm * _velocityPerRPM) >> 32;
+
+    return (int32_t)velocity * _sensor.ReadDirection();
+}
+
+
+/*******************************************************************************
+ Restarts Delta() from the current distance.
+*******************************************************************************/
+void RotationSensorOdometry::Reset()
+{
+    _lastDistance = Distance();
+}
@@ -0,0 +1,91 @@
+/*******************************************************************************
+ RotationSensorOdometry.h
+ Distance and linear velocity of a wheel driven through a rotation sensor.
+*******************************************************************************/
+
+#ifndef _RotationSensorOdometry_h_
+#define _RotationSensorOdometry_h_
+
+#include <Arduino.h>
+#include <inttypes.h>
+#include "RotationSensor.h"
+
+
+//******************************************************************************
+/// \class RotationSensorOdometry
+/// \brief Converts the counts and RPM of a sensor to wheel distance and speed.
+///
+/// The wheel geometry is given once, in floating point, and converted to Q16
+/// fixed point scale factors, so the distance and velocity queries only use
+/// integer math. Distances are in millimeters and velocities in millimeters
+/// per second, as long as the circumference is in millimeters (any other unit
+/// works the same way).
+///
+/// The distance follows the signed position of the sensor, so a quadrature
+/// encoder also measures driving backwards; a single channel sensor always
+/// counts forward. Every distance is scaled from the full count, so the sum of
+/// the Delta() readings never drifts from Distance().
+//******************************************************************************
+class RotationSensorOdometry
+{
+    //**************************************************************************
+    /// Constructor. circumference is the distance covered by one revolution of
+    /// the wheel, and gearRatio the number of sensor revolutions per wheel
+    /// revolution, e.g., for an encoder on the motor shaft. A negative ratio
+    /// reverses the direction, e.g., for the mirrored wheel of a differential
+    /// drive with quadrature encoders. A single channel sensor counts up
+    /// whichever way its wheel turns, so its ratio must stay positive.
+    //**************************************************************************
+    public: RotationSensorOdometry(RotationSensor& sensor, float circumference, float gearRatio=1);
+
+    //**************************************************************************
+    /// Returns the distance covered since the sensor was reset.
+    //**************************************************************************
+    public: int32_t Distance();
+
+    //**************************************************************************
+    /// Returns the distance covered since the last call (or since the
+    /// odometry was constructed or reset).
+    //**************************************************************************
+    public: int32_t Delta();
+
+    //**************************************************************************
+    /// Returns the distance covered since the last call, up to a sensor
+    /// position read beforehand, e.g., with RotationSensorGroup::ReadPositions()
+    /// together with the positions of other wheels.
+    //**************************************************************************
+    public: int32_t Delta(int32_t position);
+
+    //**************************************************************************
+    /// Returns the linear velocity of the wheel, from the RPM averaged over the
+    /// last windowPulses pulse intervals, as for
+    /// RotationSensor::ReadRPM_Q16(windowPulses). Negative in reverse.
+    //**************************************************************************
+    public: int32_t Velocity(uint8_t windowPulses=1);
+
+    //**************************************************************************
+    /// Restarts Delta() from the current distance. Call it after resetting
+    /// the sensor.
+    //**************************************************************************
+    public: void Reset();
+
+    //**************************************************************************
+    /// Returns the distance covered by a number of sensor counts.
+    //**************************************************************************
+    public: int32_t CountsToDistance(int32_t counts);
+
+    //**************************************************************************
+    /// Returns the sensor.
+    //**************************************************************************
+    public: RotationSensor& Sensor() { return _sensor; };
+
+    /***************************************************************************
+     Internal implementation
+    ***************************************************************************/
+    private: RotationSensor& _sensor;
+    private: int32_t _distancePerCount;         // Q16 distance per count, signed
+    private: int32_t _velocityPerRPM;           // Q16 velocity per RPM, signed
+    private: int32_t _lastDistance;             // Distance at the last Delta()
+};
+
+#endif
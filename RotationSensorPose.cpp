@@ -0,0 +1,76 @@
+/*******************************************************************************
+ RotationSensorPose.cpp
+ Pose of a differential drive robot integrated from its wheel odometry.
+*******************************************************************************/
+
+#include <Arduino.h>
+#include <math.h>
+
+#include "RotationSensorPose.h"
+
+
+// Wraps an angle to -PI..PI, for an angle less than one turn out of range
+static float WrapAngle(float angle)
+{
+    if (angle > (float)M_PI) return angle - 2 * (float)M_PI;
+    if (angle < -(float)M_PI) return angle + 2 * (float)M_PI;
+
+    return angle;
+}
+
+
+/*******************************************************************************
+ Constructor
+*******************************************************************************/
+RotationSensorPose::RotationSensorPose(RotationSensorOdometry& left, RotationSensorOdometry& right, float trackWidth)
+    : _left(left), _right(right)
+{
+    _wheels.Add(left.Sensor());
+    _wheels.Add(right.Sensor());
+    _trackWidth = trackWidth;
+    _x = 0;
+    _y = 0;
+    _heading = 0;
+}
+
+
+/*******************************************************************************
+ Integrates the wheel movement since the last call, as an arc of length d and
+ heading change dHeading, approximated by a straight step at the mid heading.
+ Both wheel positions are taken from a single snapshot.
+*******************************************************************************/
+float RotationSensorPose::Update()
+{
+    int32_t positions[2];
+
+    _wheels.ReadPositions(positions);
+
+    int32_t left  = _left.Delta(positions[0]);
+    int32_t right = _right.Delta(positions[1]);
+
+    if (left == 0 && right == 0) return 0;
+
+    float d        = (float)(left + right) / 2;
+    float dHeading = (float)(right - left) / _trackWidth;
+    float mid      = _heading + dHeading / 2;
+
+    _x += d * cos(mid);
+    _y += d * sin(mid);
+    _heading = WrapAngle(_heading + dHeading);
+
+    return d;
+}
+
+
+/*******************************************************************************
+ Sets the pose.
+*******************************************************************************/
+void RotationSensorPose::SetPose(float x, float y, float heading)
+{
+    _left.Reset();
+    _right.Reset();
+
+    _x = x;
+    _y = y;
+    _heading = WrapAngle(heading);
+}
@@ -0,0 +1,73 @@
+/*******************************************************************************
+ RotationSensorPose.h
+ Pose of a differential drive robot integrated from its wheel odometry.
+*******************************************************************************/
+
+#ifndef _RotationSensorPose_h_
+#define _RotationSensorPose_h_
+
+#include <Arduino.h>
+#include <inttypes.h>
+#include "RotationSensorOdometry.h"
+#include "RotationSensorGroup.h"
+
+
+//******************************************************************************
+/// \class RotationSensorPose
+/// \brief Dead reckoning of a differential drive robot.
+///
+/// Update() integrates the distance covered by each wheel since the last call
+/// into a pose: the position of the point midway between the wheels, in the
+/// unit of the wheel odometry, and the heading in radians, counterclockwise
+/// from the x axis. Each step follows an arc approximated at its mid heading,
+/// so the error only grows with the heading change per step; call Update()
+/// often enough that the robot turns less than a few degrees between calls.
+/// The pose is kept in floating point, for the trigonometry; the wheel
+/// distances are the fixed point deltas of RotationSensorOdometry. Both wheel
+/// positions are read at the same instant through a RotationSensorGroup, so
+/// the pulses between two separate reads do not show up as a heading change.
+//******************************************************************************
+class RotationSensorPose
+{
+    //**************************************************************************
+    /// Constructor. trackWidth is the distance between the wheels, in the unit
+    /// of the odometry. The pose starts at the origin, heading along the x
+    /// axis.
+    //**************************************************************************
+    public: RotationSensorPose(RotationSensorOdometry& left, RotationSensorOdometry& right, float trackWidth);
+
+    //**************************************************************************
+    /// Integrates the wheel movement since the last call. Returns the distance
+    /// covered by the midpoint.
+    //**************************************************************************
+    public: float Update();
+
+    //**************************************************************************
+    /// Sets the pose. The wheel movement so far is discarded.
+    //**************************************************************************
+    public: void SetPose(float x, float y, float heading);
+
+    //**************************************************************************
+    /// Returns the position of the midpoint between the wheels.
+    //**************************************************************************
+    public: float X() { return _x; };
+    public: float Y() { return _y; };
+
+    //**************************************************************************
+    /// Returns the heading, in radians from -PI to PI.
+    //**************************************************************************
+    public: float Heading() { return _heading; };
+
+    /***************************************************************************
+     Internal implementation
+    ***************************************************************************/
+    private: RotationSensorOdometry& _left;
+    private: RotationSensorOdometry& _right;
+    private: RotationSensorGroup _wheels;
+    private: float _trackWidth;
+    private: float _x;
+    private: float _y;
+    private: float _heading;
+};
+
+#endif
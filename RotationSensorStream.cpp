@@ -0,0 +1,106 @@
+/*******************************************************************************
+ RotationSensorStream.cpp
+ Compact binary streaming of the rotation sensor pulse trace.
+*******************************************************************************/
+
+#include <Arduino.h>
+
+#include "RotationSensorStream.h"
+
+
+/*******************************************************************************
+ Constructor
+*******************************************************************************/
+RotationSensorStream::RotationSensorStream(RotationSensor& sensor, Print& out)
+    : _sensor(sensor), _out(out), _lastCount(0), _totalLost(0)
+{
+}
+
+
+/*******************************************************************************
+ Drains the new trace entries of the sensor and writes them as one frame. The
+ number of entries drained is limited so that the frame fits in the space the
+ output has available, assuming the worst case size for each varint, so the
+ frame can always be written in full once the entries are drained.
+*******************************************************************************/
+uint8_t RotationSensorStream::Poll()
+{
+    int space = _out.availableForWrite();
+
+    if (space < HEADER_SIZE + VARINT_SIZE) return 0;
+
+    uint8_t n = (space - HEADER_SIZE) / VARINT_SIZE;
+
+    if (n > MAX_ENTRIES) n = MAX_ENTRIES;
+
+    RotationSensor::TraceEntry entries[MAX_ENTRIES];
+    uint32_t lost;
+
+    n = _sensor.DrainTrace(entries, n, &lost);
+
+    if (n == 0) return 0;
+
+    // Only a consecutive run of entries fits in a frame. If the drain skipped
+    // lost entries part way, the entries before the gap are dropped as lost
+    // too, since they cannot be written once drained.
+    uint8_t first = 0;
+
+    for (uint8_t i=1; i < n; i++)
+    {
+        if (entries[i].Count != entries[i - 1].Count + 1) first = i;
+    }
+
+    // A count that goes backwards means the sensor has been reset
+    lost = entries[first].Count - ((entries[first].Count > _lastCount) ? _lastCount : 0) - 1;
+    _totalLost += lost;
+    _lastCount = entries[n - 1].Count;
+
+    uint8_t frame[HEADER_SIZE + (MAX_ENTRIES * VARINT_SIZE)];
+    uint8_t len = 0;
+    uint16_t cpr = _sensor.Resolution();
+
+    frame[len++] = 0xA5;
+    frame[len++] = 0x5A;
+    frame[len++] = _sensor.ID();
+    frame[len++] = cpr & 0xFF;
+    frame[len++] = cpr >> 8;
+    frame[len++] = n - first;
+    len += PutVarint(&frame[len], RotationSensorTimebase::TICKS_PER_SECOND);
+    len += PutVarint(&frame[len], lost);
+    len += PutVarint(&frame[len], entries[first].Count);
+    len += PutVarint(&frame[len], entries[first].Time);
+
+    for (uint8_t i=first + 1; i < n; i++)
+    {
+        len += PutVarint(&frame[len], entries[i].Time - entries[i - 1].Time);
+    }
+
+    uint8_t checksum = 0;
+
+    for (uint8_t i=2; i < len; i++) checksum += frame[i];
+
+    frame[len++] = checksum;
+
+    _out.write(frame, len);
+
+    return n - first;
+}
+
+
+/*******************************************************************************
+ Writes value as an unsigned LEB128 varint and returns the number of bytes.
+*******************************************************************************/
+uint8_t RotationSensorStream::PutVarint(uint8_t* p, uint32_t value)
+{
+    uint8_t len = 0;
+
+    while (value >= 0x80)
+    {
+        p[len++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+
+    p[len++] = value;
+
+    return len;
+}
@@ -0,0 +1,79 @@
+/*******************************************************************************
+ RotationSensorStream.h
+ Compact binary streaming of the rotation sensor pulse trace.
+*******************************************************************************/
+
+#ifndef _RotationSensorStream_h_
+#define _RotationSensorStream_h_
+
+#include <Arduino.h>
+#include <inttypes.h>
+#include "RotationSensor.h"
+
+
+//******************************************************************************
+/// \class RotationSensorStream
+/// \brief Streams the pulse trace of a sensor as compact binary frames.
+///
+/// Poll() drains the new pulse trace entries of the sensor and writes them as a
+/// frame, but only if the output has room for the whole frame, so it never
+/// blocks. Timestamps are delta encoded as varints (LEB128, 7 bits per byte,
+/// least significant first), so a pulse typically takes 2 or 3 bytes.
+///
+/// Frame layout:
+///
+///     0xA5 0x5A             Sync
+///     uint8   SensorID      Sensor pin number
+///     uint16  CountsPerRev  Little endian
+///     uint8   N             Number of entries in the frame (1..MAX_ENTRIES)
+///     varint  TicksPerSec   Timebase rate of the timestamps
+///     varint  Lost          Entries lost since the previous frame
+///     varint  Count         Pulse count of the first entry
+///     varint  Time          Timestamp of the first entry
+///     varint  Delta[N-1]    Timestamp deltas of the following entries, whose
+///                           counts follow on consecutively
+///     uint8   Checksum      Sum of all the bytes after the sync bytes
+///
+/// extras/decode_stream.py decodes a captured stream to CSV.
+//******************************************************************************
+class RotationSensorStream
+{
+    //**************************************************************************
+    /// Maximum number of entries written in a single frame.
+    //**************************************************************************
+    public: static const uint8_t MAX_ENTRIES = 8;
+
+    //**************************************************************************
+    /// Constructor. Frames are written to out, typically a HardwareSerial port,
+    /// whose availableForWrite() is used to avoid blocking.
+    //**************************************************************************
+    public: RotationSensorStream(RotationSensor& sensor, Print& out);
+
+    //**************************************************************************
+    /// Writes the trace entries recorded since the last call as one frame, if
+    /// there are any and the output has room for them. Call it as often as
+    /// possible from the main loop. Returns the number of entries written.
+    //**************************************************************************
+    public: uint8_t Poll();
+
+    //**************************************************************************
+    /// Returns the total number of trace entries lost so far because the
+    /// sensor history overflowed before they could be streamed.
+    //**************************************************************************
+    public: uint32_t Lost() { return _totalLost; };
+
+    /***************************************************************************
+     Internal implementation
+    ***************************************************************************/
+    private: static const uint8_t HEADER_SIZE  = 2 + 1 + 2 + 1 + (3 * 5) + 5 + 1;
+    private: static const uint8_t VARINT_SIZE  = 5;
+
+    private: static uint8_t PutVarint(uint8_t* p, uint32_t value);
+
+    private: RotationSensor& _sensor;
+    private: Print& _out;
+    private: uint32_t _lastCount;
+    private: uint32_t _totalLost;
+};
+
+#endif
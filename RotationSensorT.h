@@ -0,0 +1,182 @@
+/*******************************************************************************
+ RotationSensorT.h
+ Rotation sensor bound to its pin at compile time.
+*******************************************************************************/
+
+#ifndef _RotationSensorT_h_
+#define _RotationSensorT_h_
+
+#include <Arduino.h>
+#include <inttypes.h>
+#include "RotationSensor.h"
+
+
+//******************************************************************************
+/// \class RotationSensorT
+/// \brief A single channel rotation sensor on an external interrupt pin, with
+/// the pin, pulses per revolution and interrupt mode fixed at compile time.
+///
+/// An external interrupt can only serve one sensor, so each RotationSensorT
+/// type is a single sensor with static storage. Its ISR calls the pulse
+/// handler of that sensor directly, at an address known at link time, instead
+/// of looking the sensor up in the sensor table and checking it is registered.
+/// The handler also skips the quadrature dispatch, and the debounce check
+/// unless MIN_INTERVAL is set. With ROTATIONSENSOR_DIRECT_ISR the library
+/// vectors are used as is, since they already resolve the sensor table entry
+/// at a fixed address.
+///
+/// MODE is the edge the pulses are counted on: RISING, FALLING, or CHANGE
+/// for both edges, in which case PPR is the number of edges per revolution.
+///
+/// On AVR the pin is checked at compile time; elsewhere digitalPinToInterrupt()
+/// is not a constant expression, and the pin is checked by the constructor of
+/// the sensor as for RotationSensor. The conversion constants are compile time
+/// constants. The features configured in RotationSensorConfig.h
+/// are compiled in or out for all the sensors alike, as the sensor state is
+/// the same RotationSensor object. Sensor() returns that object for the rest
+/// of the API and for RotationSensorGroup, RotationSensorCalibration and
+/// RotationSensorStream.
+///
+///     typedef RotationSensorT<2, 20> LeftWheel;
+///     typedef RotationSensorT<3, 40, CHANGE> RightWheel;
+///
+///     LeftWheel::Enable();
+///     float rpm = LeftWheel::ReadRPM();
+//******************************************************************************
+template<uint8_t PIN, uint16_t PPR, int MODE = RISING, uint16_t MIN_INTERVAL = 0>
+class RotationSensorT
+{
+#if defined(__AVR__)
+    //**************************************************************************
+    /// External interrupt number of the sensor pin. Only defined on AVR, where
+    /// digitalPinToInterrupt() is a constant expression; see Irq().
+    //**************************************************************************
+    public: static const int8_t IRQ = digitalPinToInterrupt(PIN);
+
+    static_assert(IRQ != NOT_AN_INTERRUPT, "RotationSensorT requires an external interrupt pin");
+#endif
+
+    //**************************************************************************
+    /// Number of pulses per revolution.
+    //**************************************************************************
+    public: static const uint16_t PULSES_PER_REV = PPR;
+
+    //**************************************************************************
+    /// Timebase ticks per minute divided by PULSES_PER_REV: the RPM is RPM_K
+    /// divided by the pulse interval in ticks.
+    //**************************************************************************
+    public: static const RotationSensor::RPMConstant RPM_K = (60ULL * RotationSensorTimebase::TICKS_PER_SECOND) / PPR;
+
+    static_assert(MODE == RISING || MODE == FALLING || MODE == CHANGE, "RotationSensorT requires a RISING, FALLING or CHANGE mode");
+    static_assert(PPR > 0, "RotationSensorT requires at least 1 pulse per revolution");
+#if ROTATIONSENSOR_COMPACT
+    static_assert(PPR <= 1023 && PIN <= 63, "ROTATIONSENSOR_COMPACT supports pins up to 63 and up to 1023 pulses per revolution");
+#endif
+#if !ROTATIONSENSOR_DEBOUNCE
+    static_assert(MIN_INTERVAL == 0, "MIN_INTERVAL requires ROTATIONSENSOR_DEBOUNCE");
+#endif
+
+    //**************************************************************************
+    /// Returns the RPM for a pulse interval in timebase ticks, or 0 for an
+    /// interval of 0.
+    //**************************************************************************
+    public: static constexpr float IntervalToRPM(uint32_t ticks)
+    {
+        return (ticks == 0) ? 0.0f : (float)RPM_K / ticks;
+    };
+
+    //**************************************************************************
+    /// Returns the sensor, for the rest of the RotationSensor API.
+    //**************************************************************************
+    public: static RotationSensor& Sensor() { return _sensor; };
+
+    //**************************************************************************
+    /// Returns the external interrupt number of the sensor pin, or
+    /// NOT_AN_INTERRUPT. Unlike IRQ, it is available on all architectures.
+    //**************************************************************************
+    public: static int Irq() { return _sensor._state.IRQ; };
+
+    //**************************************************************************
+    /// Enables/Disables the sensor, like RotationSensor::Enable(), and binds
+    /// the external interrupt to the ISR of this sensor, triggered on MODE.
+    //**************************************************************************
+    public: static void Enable(bool enabled=true)
+    {
+        _sensor.Enable(enabled);
+
+        // Enable() attached the generic ISR, which goes through the sensor table,
+        // on a RISING edge. Other backends (e.g., ROTATIONSENSOR_LOW_POWER) keep
+        // their own ISRs.
+        if (_sensor.Enabled() && _sensor._state.Backend == RotationSensor::ExternalBackend)
+        {
+#if ROTATIONSENSOR_DIRECT_ISR
+            // The library vector is kept, only the edge is selected
+            if (MODE != RISING) _sensor.AttachExternal(Irq(), MODE, true);
+#elif defined(ARDUINO_ARCH_ESP32)
+            // A template ISR cannot be placed in IRAM, see RotationSensor.cpp
+            attachInterruptArg(Irq(), (MIN_INTERVAL != 0) ? RotationSensor_DebouncedEdgeISR : RotationSensor_EdgeISR,
+                               &_sensor, MODE);
+#else
+            attachInterrupt(Irq(), Handler, MODE);
+#endif
+        }
+    };
+
+    //**************************************************************************
+    /// Disables the sensor.
+    //**************************************************************************
+    public: static void Disable() { Enable(false); };
+
+    //**************************************************************************
+    /// Returns the enabled state of the sensor.
+    //**************************************************************************
+    public: static bool Enabled() { return _sensor.Enabled(); };
+
+    //**************************************************************************
+    /// Resets the sensor counter values to 0.
+    //**************************************************************************
+    public: static void Reset() { _sensor.Reset(); };
+
+    //**************************************************************************
+    /// Returns the count data, as RotationSensor::Read().
+    //**************************************************************************
+    public: static RotationSensor::CountData Read() { return _sensor.Read(); };
+
+    //**************************************************************************
+    /// Returns the pulse count, as RotationSensor::ReadCount().
+    //**************************************************************************
+    public: static uint32_t ReadCount() { return _sensor.ReadCount(); };
+
+    //**************************************************************************
+    /// Returns the RPM over the last windowPulses pulse intervals, as
+    /// RotationSensor::ReadRPM(windowPulses).
+    //**************************************************************************
+    public: static float ReadRPM(uint8_t windowPulses=1) { return _sensor.ReadRPM(windowPulses); };
+
+    //**************************************************************************
+    /// Updates the cached RPM, as RotationSensor::Update().
+    //**************************************************************************
+    public: static void Update(uint8_t windowPulses=1) { _sensor.Update(windowPulses); };
+
+    //**************************************************************************
+    /// Returns the cached RPM, as RotationSensor::LatestRPM_Q16(), with a load
+    /// from a fixed address.
+    //**************************************************************************
+    public: static uint32_t LatestRPM_Q16() { return _sensor.LatestRPM_Q16(); };
+
+    /***************************************************************************
+     Internal implementation
+    ***************************************************************************/
+    private: static void Handler()
+    {
+        _sensor.Edge_ISR<(MIN_INTERVAL != 0)>(RotationSensorTimebase::NowFromISR());
+    };
+
+    private: static RotationSensor _sensor;
+};
+
+
+template<uint8_t PIN, uint16_t PPR, int MODE, uint16_t MIN_INTERVAL>
+RotationSensor RotationSensorT<PIN, PPR, MODE, MIN_INTERVAL>::_sensor(PIN, PPR, MIN_INTERVAL);
+
+#endif
@@ -0,0 +1,231 @@
+/*******************************************************************************
+ RotationSensorTimebase.cpp
+ Clock used to timestamp the rotation sensor pulses.
+*******************************************************************************/
+
+#include <Arduino.h>
+
+#include "RotationSensorTimebase.h"
+
+
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER1
+
+#if ROTATIONSENSOR_TIMER1_PRESCALER == 1
+static const uint8_t TIMER1_CLOCK_SELECT = _BV(CS10);
+#elif ROTATIONSENSOR_TIMER1_PRESCALER == 8
+static const uint8_t TIMER1_CLOCK_SELECT = _BV(CS11);
+#elif ROTATIONSENSOR_TIMER1_PRESCALER == 64
+static const uint8_t TIMER1_CLOCK_SELECT = _BV(CS11) | _BV(CS10);
+#else
+#error "ROTATIONSENSOR_TIMER1_PRESCALER must be 1, 8 or 64"
+#endif
+
+volatile uint16_t RotationSensorTimebase::_overflows = 0;
+
+
+/*******************************************************************************
+ Starts Timer1 in normal (free running) mode, replacing the PWM configuration
+ the Arduino core sets up at startup.
+*******************************************************************************/
+void RotationSensorTimebase::Begin()
+{
+    if ((TCCR1B & (_BV(CS12) | _BV(CS11) | _BV(CS10))) == TIMER1_CLOCK_SELECT && (TIMSK1 & _BV(TOIE1))) return;
+
+    uint8_t sreg = SREG;
+    cli();
+    TCCR1B = 0;
+    TCCR1A = 0;
+    TCNT1  = 0;
+    _overflows = 0;
+#if ROTATIONSENSOR_EXTENDED_TIME
+    _epoch = 0;
+    _epochTime = 0;
+#endif
+    TIFR1  = _BV(TOV1);
+    TIMSK1 |= _BV(TOIE1);
+    TCCR1B = TIMER1_CLOCK_SELECT;
+    SREG = sreg;
+}
+
+
+void RotationSensorTimebase_OverflowISR()
+{
+    RotationSensorTimebase::_overflows++;
+}
+
+
+ISR(TIMER1_OVF_vect)
+{
+    RotationSensorTimebase_OverflowISR();
+}
+
+#elif ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER2
+
+#if ROTATIONSENSOR_TIMER2_PRESCALER == 1
+static const uint8_t TIMER2_CLOCK_SELECT = _BV(CS20);
+#elif ROTATIONSENSOR_TIMER2_PRESCALER == 8
+static const uint8_t TIMER2_CLOCK_SELECT = _BV(CS21);
+#elif ROTATIONSENSOR_TIMER2_PRESCALER == 32
+static const uint8_t TIMER2_CLOCK_SELECT = _BV(CS21) | _BV(CS20);
+#elif ROTATIONSENSOR_TIMER2_PRESCALER == 64
+static const uint8_t TIMER2_CLOCK_SELECT = _BV(CS22);
+#elif ROTATIONSENSOR_TIMER2_PRESCALER == 128
+static const uint8_t TIMER2_CLOCK_SELECT = _BV(CS22) | _BV(CS20);
+#else
+#error "ROTATIONSENSOR_TIMER2_PRESCALER must be 1, 8, 32, 64 or 128"
+#endif
+
+volatile uint32_t RotationSensorTimebase::_overflows = 0;
+
+static void StartProfileClock();
+
+
+/*******************************************************************************
+ Starts Timer2 in normal (free running) mode, clocked asynchronously from the
+ 32768Hz crystal on TOSC1/TOSC2, replacing the PWM configuration the Arduino
+ core sets up at startup. The timer keeps running in power-save mode.
+
+ The new settings only take effect once they are synchronized with the crystal
+ clock, which is waited for before the overflow interrupt is enabled.
+*******************************************************************************/
+void RotationSensorTimebase::Begin()
+{
+    StartProfileClock();
+
+    if ((ASSR & _BV(AS2)) && (TIMSK2 & _BV(TOIE2))) return;
+
+    uint8_t sreg = SREG;
+    cli();
+    TIMSK2 = 0;
+    ASSR   = _BV(AS2);
+    TCNT2  = 0;
+    TCCR2A = 0;
+    TCCR2B = TIMER2_CLOCK_SELECT;
+
+    while (ASSR & (_BV(TCN2UB) | _BV(TCR2AUB) | _BV(TCR2BUB))) { }
+
+    _overflows = 0;
+#if ROTATIONSENSOR_EXTENDED_TIME
+    _epoch = 0;
+    _epochTime = 0;
+#endif
+    TIFR2  = _BV(TOV2);
+    TIMSK2 = _BV(TOIE2);
+    SREG = sreg;
+}
+
+
+void RotationSensorTimebase_OverflowISR()
+{
+    RotationSensorTimebase::_overflows++;
+}
+
+
+ISR(TIMER2_OVF_vect)
+{
+    RotationSensorTimebase_OverflowISR();
+}
+
+#elif ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_CYCCNT
+
+// Prefixed, since some cores define the DWT registers under these names
+#define ROTATIONSENSOR_DEMCR    (*(volatile uint32_t*)0xE000EDFCUL)
+#define ROTATIONSENSOR_DWT_CTRL (*(volatile uint32_t*)0xE0001000UL)
+#define ROTATIONSENSOR_DWT_LAR  (*(volatile uint32_t*)0xE0001FB0UL)
+
+static const uint32_t DEMCR_TRCENA       = 1UL << 24;
+static const uint32_t DWT_CTRL_CYCCNTENA = 1UL << 0;
+static const uint32_t DWT_LAR_UNLOCK     = 0xC5ACCE55UL;
+
+
+/*******************************************************************************
+ Starts the DWT cycle counter, without resetting it, since a debugger or other
+ code may already be using it. The lock access register only exists on some
+ Cortex-M7 parts, and writing it is ignored elsewhere.
+*******************************************************************************/
+void RotationSensorTimebase::Begin()
+{
+    noInterrupts();
+    if (!(ROTATIONSENSOR_DWT_CTRL & DWT_CTRL_CYCCNTENA))
+    {
+        ROTATIONSENSOR_DEMCR |= DEMCR_TRCENA;
+        ROTATIONSENSOR_DWT_LAR = DWT_LAR_UNLOCK;
+        ROTATIONSENSOR_DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+    }
+#if ROTATIONSENSOR_EXTENDED_TIME
+    if (_epoch == 0 && _epochTime == 0) _epochTime = NowFromISR();
+#endif
+    interrupts();
+}
+
+#else
+
+static void StartProfileClock();
+
+
+/*******************************************************************************
+ micros() is always running, so the wraps are counted from the first call, at
+ whatever time micros() has reached by then.
+*******************************************************************************/
+void RotationSensorTimebase::Begin()
+{
+    StartProfileClock();
+
+#if ROTATIONSENSOR_EXTENDED_TIME
+    uint32_t saved = LockEpoch();
+    if (_epoch == 0 && _epochTime == 0) _epochTime = micros();
+    UnlockEpoch(saved);
+#endif
+}
+
+#endif
+
+
+#if ROTATIONSENSOR_EXTENDED_TIME
+volatile uint16_t RotationSensorTimebase::_epoch = 0;
+volatile uint32_t RotationSensorTimebase::_epochTime = 0;
+#if defined(ARDUINO_ARCH_ESP32)
+portMUX_TYPE RotationSensorTimebase::_epochLock = portMUX_INITIALIZER_UNLOCKED;
+#endif
+
+
+/*******************************************************************************
+ Returns the current timestamp extended with the wrap count. The wrap count and
+ the timestamp it goes with are only written here, with interrupts disabled, so
+ that EpochFromISR() always reads a matching pair. On ESP32 and RP2040 that only
+ holds off the calling core, so the pair is also guarded by a spin lock there.
+*******************************************************************************/
+uint64_t RotationSensorTimebase::NowExtended()
+{
+    uint32_t saved = LockEpoch();
+    uint32_t now   = NowFromISR();
+    uint16_t epoch = Epoch(now);
+
+    _epoch = epoch;
+    _epochTime = now;
+    UnlockEpoch(saved);
+
+    return ((uint64_t)epoch << 32) | now;
+}
+#endif
+
+
+#if ROTATIONSENSOR_TIMEBASE != ROTATIONSENSOR_TIMEBASE_TIMER1 && ROTATIONSENSOR_TIMEBASE != ROTATIONSENSOR_TIMEBASE_CYCCNT
+/*******************************************************************************
+ For profiling, starts Timer1 in normal (free running) mode at the CPU clock
+ rate, replacing the PWM configuration the Arduino core sets up at startup.
+*******************************************************************************/
+static void StartProfileClock()
+{
+#if ROTATIONSENSOR_PROFILING
+    if (TCCR1A == 0 && TCCR1B == _BV(CS10)) return;
+
+    uint8_t sreg = SREG;
+    cli();
+    TCCR1B = 0;
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+    SREG = sreg;
+#endif
+}
+#endif
@@ -0,0 +1,317 @@
+/*******************************************************************************
+ RotationSensorTimebase.h
+ Clock used to timestamp the rotation sensor pulses.
+*******************************************************************************/
+
+#ifndef _RotationSensorTimebase_h_
+#define _RotationSensorTimebase_h_
+
+#include <Arduino.h>
+#include <inttypes.h>
+#include "RotationSensorConfig.h"
+
+#if defined(ARDUINO_ARCH_RP2040)
+#include <hardware/sync.h>
+#endif
+
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER1 && !defined(__AVR__)
+#error "ROTATIONSENSOR_TIMEBASE_TIMER1 is only available on AVR MCUs"
+#endif
+
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER2 && !(defined(__AVR__) && defined(ASSR))
+#error "ROTATIONSENSOR_TIMEBASE_TIMER2 requires an AVR MCU with an asynchronous Timer2"
+#endif
+
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_CYCCNT && \
+    !(defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || defined(__ARM_ARCH_8M_MAIN__))
+#error "ROTATIONSENSOR_TIMEBASE_CYCCNT requires a Cortex-M3/M4/M7/M33 MCU"
+#endif
+
+// A name such as SystemCoreClock evaluates to 0 here, like a missing rate
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_CYCCNT && !(ROTATIONSENSOR_CYCCNT_HZ > 0)
+#error "ROTATIONSENSOR_TIMEBASE_CYCCNT requires ROTATIONSENSOR_CYCCNT_HZ, the CPU clock in Hz, as a number"
+#endif
+
+// Places the code of the pulse ISRs, and the inline functions they call, in
+// IRAM on ESP32, so that a pulse during a flash write does not crash the chip
+#if defined(ARDUINO_ARCH_ESP32)
+#define ROTATIONSENSOR_IRAM_ATTR IRAM_ATTR
+#else
+#define ROTATIONSENSOR_IRAM_ATTR
+#endif
+
+#if ROTATIONSENSOR_PROFILING && (!defined(__AVR__) || ROTATIONSENSOR_USE_T1_COUNTER)
+#error "ROTATIONSENSOR_PROFILING requires an AVR MCU and cannot be combined with ROTATIONSENSOR_USE_T1_COUNTER"
+#endif
+
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_CYCCNT
+// The DWT registers are at the same address on every Cortex-M, so they are
+// accessed directly rather than through the CMSIS headers of each core
+#define ROTATIONSENSOR_DWT_CYCCNT (*(volatile uint32_t*)0xE0001004UL)
+#endif
+
+
+//******************************************************************************
+/// \class RotationSensorTimebase
+/// \brief The clock used to timestamp the rotation sensor pulses.
+///
+/// Timestamps are 32 bit tick counts that wrap around, so time intervals must
+/// always be computed as the unsigned difference of two timestamps. With
+/// ROTATIONSENSOR_EXTENDED_TIME the wraps are also counted, which extends the
+/// timestamps to 64 bits (see NowExtended()).
+//******************************************************************************
+class RotationSensorTimebase
+{
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER1
+    public: static const uint32_t TICKS_PER_SECOND = F_CPU / ROTATIONSENSOR_TIMER1_PRESCALER;
+#elif ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER2
+    public: static const uint32_t TICKS_PER_SECOND = 32768UL / ROTATIONSENSOR_TIMER2_PRESCALER;
+#elif ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_CYCCNT
+    public: static const uint32_t TICKS_PER_SECOND = ROTATIONSENSOR_CYCCNT_HZ;
+#else
+    public: static const uint32_t TICKS_PER_SECOND = 1000000UL;
+#endif
+
+    //**************************************************************************
+    /// Smallest step of the timestamps, in ticks: the AVR micros() function
+    /// counts in steps of 64 CPU cycles (4 microseconds at 16MHz).
+    //**************************************************************************
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_MICROS && defined(__AVR__)
+    public: static const uint8_t RESOLUTION = (64000000UL + F_CPU - 1) / F_CPU;
+#else
+    public: static const uint8_t RESOLUTION = 1;
+#endif
+
+    //**************************************************************************
+    /// Starts the clock. Called by RotationSensor::Enable(), so it is normally
+    /// not necessary to call it directly. Calling it again has no effect.
+    //**************************************************************************
+    public: static void Begin();
+
+    //**************************************************************************
+    /// Returns the current timestamp. Can only be called from an ISR or with
+    /// interrupts disabled.
+    //**************************************************************************
+    public: static inline ROTATIONSENSOR_IRAM_ATTR uint32_t NowFromISR()
+    {
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER1
+        uint16_t high = _overflows;
+        uint16_t low  = TCNT1;
+
+        // An overflow that has not been serviced yet belongs to this reading
+        // if the counter value is from after the overflow.
+        if ((TIFR1 & _BV(TOV1)) && (low < 0x8000)) high++;
+
+        return ((uint32_t)high << 16) | low;
+#elif ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER2
+        uint32_t high = _overflows;
+        uint8_t  low  = TCNT2;
+
+        if ((TIFR2 & _BV(TOV2)) && (low < 0x80)) high++;
+
+        return (high << 8) | low;
+#elif ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_CYCCNT
+        return ROTATIONSENSOR_DWT_CYCCNT;
+#else
+        return micros();
+#endif
+    };
+
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER1
+    //**************************************************************************
+    /// Returns the timestamp latched by the Timer1 input capture unit. Can only
+    /// be called from the input capture ISR.
+    //**************************************************************************
+    public: static inline uint32_t CaptureFromISR()
+    {
+        uint16_t low  = ICR1;
+        uint16_t high = _overflows;
+
+        // The capture ISR has priority over the overflow ISR, so the overflow
+        // may still be pending. It belongs to the capture if the captured value
+        // is from after the overflow.
+        if ((TIFR1 & _BV(TOV1)) && (low < 0x8000)) high++;
+
+        return ((uint32_t)high << 16) | low;
+    };
+#endif
+
+    //**************************************************************************
+    /// Returns the current timestamp.
+    //**************************************************************************
+    public: static inline uint32_t Now()
+    {
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER1 || ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER2
+        uint8_t sreg = SREG;
+        cli();
+        uint32_t now = NowFromISR();
+        SREG = sreg;
+        return now;
+#elif ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_CYCCNT
+        // A single 32 bit load, atomic without masking the interrupts
+        return ROTATIONSENSOR_DWT_CYCCNT;
+#else
+        return micros();
+#endif
+    };
+
+    //**************************************************************************
+    /// Converts a number of timestamp ticks to microseconds.
+    //**************************************************************************
+    public: static inline uint32_t TicksToMicros(uint32_t ticks)
+    {
+        // The rates are constants, so only one of the branches is compiled in.
+        // The 64 bit math is only needed when neither rate divides the other,
+        // as with the 32768Hz crystal of the TIMER2 timebase.
+        if (TICKS_PER_SECOND % 1000000UL == 0) return ticks / TICKS_PER_MICROSECOND;
+        if (1000000UL % TICKS_PER_SECOND == 0) return ticks * MICROSECONDS_PER_TICK;
+
+        return (uint32_t)((uint64_t)ticks * 1000000UL / TICKS_PER_SECOND);
+    };
+
+    //**************************************************************************
+    /// Converts a number of 64 bit extended timestamp ticks to microseconds.
+    //**************************************************************************
+    public: static inline uint64_t TicksToMicros64(uint64_t ticks)
+    {
+        if (TICKS_PER_SECOND % 1000000UL == 0) return ticks / TICKS_PER_MICROSECOND;
+        if (1000000UL % TICKS_PER_SECOND == 0) return ticks * MICROSECONDS_PER_TICK;
+
+        // Whole seconds first, so the product cannot overflow
+        return (ticks / TICKS_PER_SECOND) * 1000000UL + (ticks % TICKS_PER_SECOND) * 1000000UL / TICKS_PER_SECOND;
+    };
+
+    //**************************************************************************
+    /// Converts a number of microseconds to timestamp ticks.
+    //**************************************************************************
+    public: static inline uint32_t MicrosToTicks(uint32_t us)
+    {
+        if (TICKS_PER_SECOND % 1000000UL == 0) return us * TICKS_PER_MICROSECOND;
+        if (1000000UL % TICKS_PER_SECOND == 0) return us / MICROSECONDS_PER_TICK;
+
+        return (uint32_t)((uint64_t)us * TICKS_PER_SECOND / 1000000UL);
+    };
+
+#if ROTATIONSENSOR_EXTENDED_TIME
+    //**************************************************************************
+    /// Returns the current timestamp extended to 64 bits: the number of times
+    /// the 32 bit timestamp wrapped around since the clock started in the high
+    /// 32 bits. The wrap count is 16 bits, so the extended timestamp itself
+    /// wraps after 65536 wrap periods (8.9 years with micros()).
+    ///
+    /// The wraps are detected by comparing the timestamp with the one of the
+    /// last call, so this must be called at least once every half wrap period
+    /// (35.8 minutes with micros()). Cannot be called from an ISR.
+    ///
+    /// On ESP32 and RP2040, where noInterrupts() only masks the calling core,
+    /// the wrap count and its timestamp are guarded by a spin lock, so this
+    /// can be called from either core while pulses are counted on the other.
+    //**************************************************************************
+    public: static uint64_t NowExtended();
+
+    //**************************************************************************
+    /// Returns the wrap count that goes with a timestamp taken less than half a
+    /// wrap period from the last call to NowExtended(). Only uses 32 bit math,
+    /// for the pulse ISRs. Can only be called from an ISR or with interrupts
+    /// disabled.
+    //**************************************************************************
+    public: static inline ROTATIONSENSOR_IRAM_ATTR uint16_t EpochFromISR(uint32_t time)
+    {
+#if defined(ARDUINO_ARCH_ESP32) || defined(ARDUINO_ARCH_RP2040)
+        uint32_t saved = LockEpoch();
+        uint16_t epoch = Epoch(time);
+
+        UnlockEpoch(saved);
+        return epoch;
+#else
+        return Epoch(time);
+#endif
+    };
+
+    // The wrap count that goes with a timestamp, without taking the lock
+    private: static inline ROTATIONSENSOR_IRAM_ATTR uint16_t Epoch(uint32_t time)
+    {
+        uint16_t epoch = _epoch;
+        int32_t  delta = (int32_t)(time - _epochTime);
+
+        // A timestamp after _epochTime that is lower wrapped since, and one
+        // before _epochTime that is higher is from before the last wrap
+        if (delta >= 0 && time < _epochTime) epoch++;
+        if (delta < 0 && time > _epochTime) epoch--;
+
+        return epoch;
+    };
+
+    // Hold off the other core, as well as the interrupts of the calling core,
+    // while the wrap count and its timestamp are read or written
+#if defined(ARDUINO_ARCH_ESP32)
+    private: static portMUX_TYPE _epochLock;
+
+    private: static inline ROTATIONSENSOR_IRAM_ATTR uint32_t LockEpoch() { portENTER_CRITICAL_SAFE(&_epochLock); return 0; };
+
+    private: static inline ROTATIONSENSOR_IRAM_ATTR void UnlockEpoch(uint32_t) { portEXIT_CRITICAL_SAFE(&_epochLock); };
+#elif defined(ARDUINO_ARCH_RP2040)
+    private: static inline uint32_t LockEpoch() { return spin_lock_blocking(spin_lock_instance(PICO_SPINLOCK_ID_STRIPED_FIRST)); };
+
+    private: static inline void UnlockEpoch(uint32_t saved) { spin_unlock(spin_lock_instance(PICO_SPINLOCK_ID_STRIPED_FIRST), saved); };
+#else
+    private: static inline uint32_t LockEpoch() { noInterrupts(); return 0; };
+
+    private: static inline void UnlockEpoch(uint32_t) { interrupts(); };
+#endif
+#endif
+
+    //**************************************************************************
+    /// Waits until the clock can be put to sleep. With the TIMER2 timebase the
+    /// MCU must not re-enter power-save mode until the asynchronous timer has
+    /// seen at least one crystal clock edge since it woke up. Called by
+    /// RotationSensor::Sleep().
+    //**************************************************************************
+    public: static inline void PrepareSleep()
+    {
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER2
+        // Writing to an asynchronous register sets its update busy flag until
+        // the write is synchronized with the crystal clock
+        OCR2A = 0;
+        while (ASSR & _BV(OCR2AUB)) { }
+#endif
+    };
+
+#if ROTATIONSENSOR_PROFILING
+    //**************************************************************************
+    /// Number of CPU cycles per tick of the profiling clock.
+    //**************************************************************************
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER1
+    public: static const uint8_t CYCLES_PER_PROFILE_TICK = ROTATIONSENSOR_TIMER1_PRESCALER;
+#else
+    public: static const uint8_t CYCLES_PER_PROFILE_TICK = 1;
+#endif
+
+    //**************************************************************************
+    /// Returns the 16 bit profiling clock, Timer1. Can only be called from an
+    /// ISR or with interrupts disabled.
+    //**************************************************************************
+    public: static inline uint16_t ProfileClock() { return TCNT1; };
+#endif
+
+    // Whole ratios of the rates, 1 when the ratio is less than 1
+    private: static const uint32_t TICKS_PER_MICROSECOND = (TICKS_PER_SECOND >= 1000000UL) ? TICKS_PER_SECOND / 1000000UL : 1;
+    private: static const uint32_t MICROSECONDS_PER_TICK = (TICKS_PER_SECOND <= 1000000UL) ? 1000000UL / TICKS_PER_SECOND : 1;
+
+#if ROTATIONSENSOR_EXTENDED_TIME
+    private: static volatile uint16_t _epoch;           // Wrap count at _epochTime
+    private: static volatile uint32_t _epochTime;       // Timestamp of the last NowExtended()
+#endif
+
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER1
+    private: static volatile uint16_t _overflows;
+
+    friend void RotationSensorTimebase_OverflowISR();
+#elif ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER2
+    private: static volatile uint32_t _overflows;       // High 24 bits of the timestamp
+
+    friend void RotationSensorTimebase_OverflowISR();
+#endif
+};
+
+#endif
@@ -0,0 +1,268 @@
+/*******************************************************************************
+ Benchmark.ino
+ Measures the highest pulse rate a sensor backend counts without losing pulses,
+ the cost of the read methods and the longest interrupt disabled window.
+
+ Timer2 generates the pulses on OC2A (pin 11 on the ATmega328P), which must be
+ wired to the sensor pin: pin 2 for the external interrupt, pin 8 with
+ ROTATIONSENSOR_USE_ICP1, pin 5 with ROTATIONSENSOR_USE_T1_COUNTER. Build it
+ once per backend and timebase (see RotationSensorConfig.h) and collect the
+ output; the interrupt disabled window needs ROTATIONSENSOR_PROFILING. Each
+ table starts with a header line beginning with '#', and every row starts with
+ the table name, so the runs can be concatenated and split again. ISRCost.ino
+ measures the cycles of a single pulse ISR.
+*******************************************************************************/
+
+#include <RotationSensor.h>
+
+#if !defined(__AVR_ATmega328P__) || ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER2
+#error "This sketch needs the Timer2 of an ATmega328P, so it cannot use the TIMER2 timebase"
+#endif
+
+#if ROTATIONSENSOR_USE_ICP1
+static const int SENSOR_PIN = 8;
+#elif ROTATIONSENSOR_USE_T1_COUNTER
+static const int SENSOR_PIN = 5;
+#else
+static const int SENSOR_PIN = 2;
+#endif
+
+static const int      TONE_PIN   = 11;
+static const uint16_t GATE_MS    = 200;
+static const uint16_t ITERATIONS = 1000;
+static const uint32_t LOAD_HZ    = 10000;
+
+static const uint32_t FREQUENCIES[] =
+{
+    1000, 2000, 5000, 10000, 20000, 30000, 40000, 50000, 60000, 80000,
+    100000, 125000, 160000, 200000, 250000, 400000, 500000, 1000000
+};
+
+static const uint16_t PRESCALERS[] = { 1, 8, 32, 64, 128, 256, 1024 };
+
+RotationSensor sensor(SENSOR_PIN, 20);
+
+static uint8_t toneClock;
+
+static volatile uint32_t sink;
+static volatile float sinkFloat;
+
+
+/*******************************************************************************
+ Returns the names of the backend and timebase under test.
+*******************************************************************************/
+static const __FlashStringHelper* BackendName()
+{
+#if ROTATIONSENSOR_USE_ICP1
+    return F("capture");
+#elif ROTATIONSENSOR_USE_T1_COUNTER
+    return F("counter");
+#elif ROTATIONSENSOR_DIRECT_ISR
+    return F("direct");
+#else
+    return F("attach");
+#endif
+}
+
+
+static const __FlashStringHelper* TimebaseName()
+{
+    return ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER1 ? F("timer1") : F("micros");
+}
+
+
+static void PrintRowStart(const __FlashStringHelper* table)
+{
+    Serial.print(table);
+    Serial.print(',');
+    Serial.print(BackendName());
+    Serial.print(',');
+    Serial.print(TimebaseName());
+    Serial.print(',');
+}
+
+
+/*******************************************************************************
+ Sets up Timer2 to toggle OC2A at twice the frequency, in CTC mode, with the
+ output forced low and the timer stopped. Returns the actual frequency, the
+ closest the prescaler and the 8 bit compare value can get, or 0 if it is out
+ of range.
+*******************************************************************************/
+static uint32_t SetupTone(uint32_t frequency)
+{
+    TCCR2B = 0;
+
+    for (uint8_t i=0; i < sizeof(PRESCALERS) / sizeof(PRESCALERS[0]); i++)
+    {
+        uint32_t top = F_CPU / (2UL * PRESCALERS[i] * frequency);
+
+        if (top < 1 || top > 256) continue;
+
+        TCCR2A = _BV(COM2A1) | _BV(WGM21);      // Clear OC2A on compare...
+        TCCR2B = _BV(FOC2A);                    // ...forced now
+        TCCR2A = _BV(COM2A0) | _BV(WGM21);      // Then toggle OC2A on compare
+        OCR2A  = top - 1;
+        TCNT2  = 0;
+        toneClock = i + 1;
+
+        return F_CPU / (2UL * PRESCALERS[i] * top);
+    }
+
+    return 0;
+}
+
+
+/*******************************************************************************
+ Counts the pulses of a GATE_MS burst at the frequency, and returns the number
+ of rising edges generated in expected.
+*******************************************************************************/
+static uint32_t CountTone(uint32_t frequency, uint32_t& expected)
+{
+    sensor.Reset();
+
+    noInterrupts();
+    uint32_t start = micros();
+    TCCR2B = toneClock;
+    interrupts();
+
+    delay(GATE_MS);
+
+    noInterrupts();
+    TCCR2B = 0;
+    uint32_t elapsed = micros() - start;
+    interrupts();
+
+    expected = (uint64_t)elapsed * frequency / 1000000UL;
+
+    return sensor.ReadCount();
+}
+
+
+/*******************************************************************************
+ Returns the average cycles of a call of f, including the loop.
+*******************************************************************************/
+template<class F> static uint16_t MeasureCycles(F f)
+{
+    uint32_t start = micros();
+
+    for (uint16_t i=0; i < ITERATIONS; i++) f();
+
+    uint32_t elapsed = micros() - start;
+
+    return (uint64_t)elapsed * (F_CPU / 1000000UL) / ITERATIONS;
+}
+
+
+/*******************************************************************************
+ Sweeps the pulse rate. A rate is sustained if the count is within the timing
+ uncertainty of the gate, 2 edges plus 0.1%.
+*******************************************************************************/
+static void RunRates()
+{
+    Serial.println(F("# rate,backend,timebase,frequency_hz,expected,counted,ok"));
+
+    for (uint8_t i=0; i < sizeof(FREQUENCIES) / sizeof(FREQUENCIES[0]); i++)
+    {
+        uint32_t frequency = SetupTone(FREQUENCIES[i]);
+
+        if (frequency == 0) continue;
+
+        uint32_t expected;
+        uint32_t counted = CountTone(frequency, expected);
+        uint32_t missing = (counted < expected) ? expected - counted : 0;
+
+        PrintRowStart(F("rate"));
+        Serial.print(frequency);
+        Serial.print(',');
+        Serial.print(expected);
+        Serial.print(',');
+        Serial.print(counted);
+        Serial.print(',');
+        Serial.println((missing <= 2 + expected / 1000) ? 1 : 0);
+    }
+}
+
+
+static void PrintLatency(uint32_t load, const __FlashStringHelper* method, uint16_t cycles, uint16_t baseline)
+{
+    PrintRowStart(F("latency"));
+    Serial.print(load);
+    Serial.print(',');
+    Serial.print(method);
+    Serial.print(',');
+    Serial.println((cycles > baseline) ? cycles - baseline : 0);
+}
+
+
+/*******************************************************************************
+ Measures the read methods, net of the loop measured as "baseline", with the
+ sensor idle or counting pulses at load Hz. The times under load include the
+ pulse ISRs that land in the measurement.
+*******************************************************************************/
+static void RunLatency(uint32_t load)
+{
+    if (load != 0)
+    {
+        load = SetupTone(load);
+        TCCR2B = toneClock;
+    }
+
+    uint16_t baseline = MeasureCycles([]() { sink = 0; });
+
+    PrintRowStart(F("latency"));
+    Serial.print(load);
+    Serial.print(F(",baseline,"));
+    Serial.println(baseline);
+
+    PrintLatency(load, F("Read"),      MeasureCycles([]() { sink = sensor.Read().Count; }), baseline);
+    PrintLatency(load, F("ReadCount"), MeasureCycles([]() { sink = sensor.ReadCount(); }), baseline);
+    PrintLatency(load, F("ReadRPM"),   MeasureCycles([]() { sinkFloat = sensor.ReadRPM(); }), baseline);
+    PrintLatency(load, F("ReadRevs"),  MeasureCycles([]() { sinkFloat = sensor.ReadRevs(); }), baseline);
+
+    TCCR2B = 0;
+}
+
+
+/*******************************************************************************
+ Prints the profiling counters collected over the whole run.
+*******************************************************************************/
+static void RunProfile()
+{
+#if ROTATIONSENSOR_PROFILING
+    RotationSensor::Stats stats = sensor.ReadStats();
+
+    Serial.println(F("# blocked,backend,timebase,max_blocked_cycles,isr_avg_cycles,isr_max_cycles,read_retries"));
+    PrintRowStart(F("blocked"));
+    Serial.print(stats.MaxBlockedCycles);
+    Serial.print(',');
+    Serial.print(stats.IsrAverageCycles());
+    Serial.print(',');
+    Serial.print(stats.IsrMaxCycles);
+    Serial.print(',');
+    Serial.println(stats.ReadRetries);
+#endif
+}
+
+
+void setup()
+{
+    Serial.begin(115200);
+
+    pinMode(TONE_PIN, OUTPUT);
+    SetupTone(1000);
+
+    sensor.Enable();
+
+    RunRates();
+
+    Serial.println(F("# latency,backend,timebase,load_hz,method,cycles"));
+    RunLatency(0);
+    RunLatency(LOAD_HZ);
+
+    RunProfile();
+}
+
+
+void loop()
+{
+}
@@ -0,0 +1,79 @@
+/*******************************************************************************
+ BurstCapture.ino
+ Logs the spin-up of a fast sensor with a burst capture.
+
+ Requires ROTATIONSENSOR_TIMEBASE_TIMER1, ROTATIONSENSOR_USE_ICP1 and
+ ROTATIONSENSOR_BURST_CAPTURE in RotationSensorConfig.h, and the sensor on the
+ input capture pin (pin 8 on an Uno). Send any character to start a burst of
+ BURST_MS milliseconds; each half buffer read prints one line with the time (in
+ timebase ticks) and the average RPM over its pulses, then the pulses dropped.
+*******************************************************************************/
+
+#include <RotationSensor.h>
+
+static const int SENSOR_PIN = 8;
+static const uint32_t BURST_MS = 3000;
+
+RotationSensor sensor(SENSOR_PIN, 20);
+
+static uint32_t times[RotationSensor::BURST_SIZE];
+
+
+void setup()
+{
+    Serial.begin(1000000);
+
+    sensor.Enable();
+}
+
+
+void loop()
+{
+    if (Serial.read() < 0) return;
+
+    if (!sensor.StartBurst())
+    {
+        Serial.println(F("Burst capture not available"));
+        return;
+    }
+
+    uint32_t start = millis();
+    uint32_t lastTime = 0;
+    bool     first = true;
+    uint32_t totalLost = 0;
+    uint8_t  n;
+
+    Serial.println(F("time,rpm"));
+
+    do
+    {
+        if (millis() - start >= BURST_MS) sensor.StopBurst();
+
+        uint16_t lost;
+
+        n = sensor.ReadBurst(times, &lost);
+        totalLost += lost;
+
+        if (n == 0) continue;
+
+        // The first pulse of the burst has no interval before it
+        uint32_t from = first ? times[0] : lastTime;
+        uint8_t  pulses = first ? n - 1 : n;
+
+        lastTime = times[n - 1];
+        first = false;
+
+        if (pulses == 0 || lastTime == from) continue;
+
+        float rpm = 60.0 * RotationSensorTimebase::TICKS_PER_SECOND * pulses
+                  / ((float)(lastTime - from) * sensor.Resolution());
+
+        Serial.print(lastTime);
+        Serial.print(',');
+        Serial.println(rpm);
+    }
+    while (n != 0 || millis() - start < BURST_MS);
+
+    Serial.print(F("Lost "));
+    Serial.println(totalLost);
+}
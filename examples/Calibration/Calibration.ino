@@ -0,0 +1,56 @@
+/*******************************************************************************
+ Calibration.ino
+ Corrects the slot spacing error of an encoder disc.
+
+ On the first run, turn the disc at a steady speed: the sketch learns the
+ correction table and saves it to the EEPROM. On later runs it loads the
+ table and only aligns it with the disc, over a few revolutions at any steady
+ speed. It then prints the raw and the corrected single interval RPM, which
+ should be much steadier.
+*******************************************************************************/
+
+#include <RotationSensor.h>
+#include <RotationSensorCalibration.h>
+
+static const int SENSOR_PIN     = 2;
+static const int EEPROM_ADDRESS = 0;
+
+RotationSensor sensor(SENSOR_PIN, 20);
+RotationSensorCalibration calibration(sensor);
+
+
+void setup()
+{
+    Serial.begin(115200);
+    sensor.Enable();
+
+    if (calibration.Load(EEPROM_ADDRESS))
+    {
+        Serial.println(F("Aligning"));
+        calibration.Align();
+    }
+    else
+    {
+        Serial.println(F("Learning"));
+        calibration.Learn();
+    }
+}
+
+
+void loop()
+{
+    static bool saved = false;
+
+    if (calibration.Update()) return;
+
+    if (!saved)
+    {
+        calibration.Save(EEPROM_ADDRESS);
+        saved = true;
+    }
+
+    Serial.print(sensor.ReadRPM());
+    Serial.print(F(" "));
+    Serial.println(calibration.ReadRPM());
+    delay(100);
+}
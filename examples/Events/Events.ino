@@ -0,0 +1,55 @@
+/*******************************************************************************
+ Events.ino
+ Reacts to rotation sensor events instead of polling the count.
+
+ The sensor ISR only raises event flags; the handler runs from Dispatch() in
+ the main loop, which is free to do other work (or sleep) while no events are
+ pending.
+*******************************************************************************/
+
+#include <RotationSensor.h>
+
+static const int SENSOR_PIN = 2;
+
+RotationSensor sensor(SENSOR_PIN, 20);
+
+
+static void OnSensorEvent(RotationSensor& s, RotationSensor::CountEvent event)
+{
+    switch (event)
+    {
+        case RotationSensor::RevolutionEvent:
+            Serial.print(F("Revolution "));
+            Serial.println(s.ReadRevs());
+            break;
+
+        case RotationSensor::ThresholdEvent:
+            Serial.println(s.AboveThreshold() ? F("Above 100 RPM") : F("Below 100 RPM"));
+            break;
+
+        case RotationSensor::StallEvent:
+            Serial.println(F("Stalled"));
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+void setup()
+{
+    Serial.begin(115200);
+
+    sensor.SetEventHandler(OnSensorEvent, RotationSensor::RevolutionEvent |
+                                          RotationSensor::ThresholdEvent |
+                                          RotationSensor::StallEvent);
+    sensor.SetRPMThreshold(100);
+    sensor.Enable();
+}
+
+
+void loop()
+{
+    sensor.Dispatch();
+}
@@ -0,0 +1,100 @@
+/*******************************************************************************
+ ISRCost.ino
+ Measures the number of CPU cycles spent servicing one sensor pulse.
+
+ The sketch drives the sensor pin itself (the AVR external interrupts also
+ trigger on edges written to an output pin), so nothing needs to be connected
+ to pin 2. Build it once with ROTATIONSENSOR_DIRECT_ISR set to 0 and once with
+ it set to 1 in RotationSensorConfig.h to compare the attachInterrupt() path
+ with the direct vector path, and the same for ROTATIONSENSOR_TIMEBASE.
+*******************************************************************************/
+
+#include <RotationSensor.h>
+
+static const int SENSOR_PIN = 2;
+static const int ITERATIONS = 200;
+
+RotationSensor sensor(SENSOR_PIN, 20);
+
+static volatile uint8_t* sensorPort;
+static uint8_t sensorMask;
+
+#if ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER1
+static const uint16_t CYCLES_PER_TICK = ROTATIONSENSOR_TIMER1_PRESCALER;
+#else
+static const uint16_t CYCLES_PER_TICK = 1;
+#endif
+
+
+/*******************************************************************************
+ Returns the cycles taken by a rising edge on the sensor pin with interrupts
+ re-enabled right after the edge, so that any pending sensor ISR runs inside
+ the measured window. The minimum over ITERATIONS runs filters out the Timer0
+ and Timer1 overflow interrupts that sometimes land in the window.
+*******************************************************************************/
+static uint16_t MeasureEdge()
+{
+    uint16_t best = 0xFFFF;
+
+    for (int i=0; i < ITERATIONS; i++)
+    {
+        *sensorPort &= ~sensorMask;
+        delayMicroseconds(20);
+
+        noInterrupts();
+        uint16_t start = TCNT1;
+        *sensorPort |= sensorMask;
+        interrupts();
+        asm volatile("nop");
+        uint16_t end = TCNT1;
+
+        uint16_t cycles = (end - start) * CYCLES_PER_TICK;
+
+        if (cycles < best) best = cycles;
+    }
+
+    return best;
+}
+
+
+void setup()
+{
+    Serial.begin(115200);
+
+    sensor.Enable();
+
+#if ROTATIONSENSOR_TIMEBASE != ROTATIONSENSOR_TIMEBASE_TIMER1
+    // Run Timer1 at the CPU clock to count cycles
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+#endif
+
+    pinMode(SENSOR_PIN, OUTPUT);
+    sensorPort = portOutputRegister(digitalPinToPort(SENSOR_PIN));
+    sensorMask = digitalPinToBitMask(SENSOR_PIN);
+
+    sensor.Disable();
+    uint16_t baseline = MeasureEdge();
+
+    sensor.Enable();
+    uint16_t total = MeasureEdge();
+
+    Serial.println(F("direct_isr,timebase,baseline_cycles,edge_cycles,isr_cycles,count"));
+    Serial.print(ROTATIONSENSOR_DIRECT_ISR);
+    Serial.print(',');
+    Serial.print(ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER1 ? F("timer1") :
+                 ROTATIONSENSOR_TIMEBASE == ROTATIONSENSOR_TIMEBASE_TIMER2 ? F("timer2") : F("micros"));
+    Serial.print(',');
+    Serial.print(baseline);
+    Serial.print(',');
+    Serial.print(total);
+    Serial.print(',');
+    Serial.print(total - baseline);
+    Serial.print(',');
+    Serial.println(sensor.ReadCount());
+}
+
+
+void loop()
+{
+}
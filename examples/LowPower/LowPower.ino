@@ -0,0 +1,53 @@
+/*******************************************************************************
+ LowPower.ino
+ Battery powered flow meter: the MCU sleeps while the sensor counts.
+
+ Set ROTATIONSENSOR_LOW_POWER and ROTATIONSENSOR_USE_PCINT to 1 in
+ RotationSensorConfig.h, and preferably ROTATIONSENSOR_TIMEBASE to
+ ROTATIONSENSOR_TIMEBASE_TIMER2 with a 32768Hz crystal on TOSC1/TOSC2 so the
+ timeout and the flow rate stay accurate across sleeps. Without
+ ROTATIONSENSOR_LOW_POWER the sketch still works, but never sleeps.
+
+ Each pulse wakes the MCU just long enough for the ISR to count it. The main
+ loop only runs every PULSES_PER_REPORT pulses, or after REPORT_TIMEOUT_MS
+ without them.
+*******************************************************************************/
+
+#include <RotationSensor.h>
+
+static const int      SENSOR_PIN        = 2;
+static const int      PULSES_PER_LITER  = 450;
+static const uint16_t PULSES_PER_REPORT = 450;
+static const uint16_t REPORT_TIMEOUT_MS = 10000;
+
+RotationSensor sensor(SENSOR_PIN, PULSES_PER_LITER);
+
+
+static void OnPulses(RotationSensor&, RotationSensor::CountEvent)
+{
+}
+
+
+void setup()
+{
+    Serial.begin(9600);
+
+    sensor.SetEventHandler(OnPulses, RotationSensor::PulseEvent);
+    sensor.SetPulseEvent(PULSES_PER_REPORT);
+    sensor.Enable();
+}
+
+
+void loop()
+{
+    sensor.SleepUntilEvent(REPORT_TIMEOUT_MS);
+    sensor.Dispatch();
+
+    Serial.print(F("Liters: "));
+    Serial.print(sensor.ReadRevs());
+    Serial.print(F(", L/min: "));
+    Serial.println(sensor.ReadRPM(RotationSensor::HISTORY_SIZE - 1));
+
+    // Let the transmission complete before sleeping again
+    Serial.flush();
+}
@@ -0,0 +1,57 @@
+/*******************************************************************************
+ Odometry.ino
+ Tracks the pose of a differential drive robot from its wheel encoders.
+
+ Each wheel has a 20 slot encoder disc on the motor shaft, geared 1:48 to a
+ 65mm wheel. The single channel sensors count up whichever way the wheels
+ turn, so both ratios are positive. With quadrature encoders, the mirrored
+ right wheel counts down when driving forward, and its ratio would be
+ negative instead.
+*******************************************************************************/
+
+#include <RotationSensor.h>
+#include <RotationSensorOdometry.h>
+#include <RotationSensorPose.h>
+
+static const float WHEEL_CIRCUMFERENCE = 65 * PI;      // mm
+static const float GEAR_RATIO          = 48;
+static const float TRACK_WIDTH         = 135;          // mm
+
+RotationSensor leftSensor(2, 20);
+RotationSensor rightSensor(3, 20);
+
+RotationSensorOdometry leftWheel(leftSensor, WHEEL_CIRCUMFERENCE, GEAR_RATIO);
+RotationSensorOdometry rightWheel(rightSensor, WHEEL_CIRCUMFERENCE, GEAR_RATIO);
+
+RotationSensorPose pose(leftWheel, rightWheel, TRACK_WIDTH);
+
+
+void setup()
+{
+    Serial.begin(115200);
+
+    leftSensor.Enable();
+    rightSensor.Enable();
+}
+
+
+void loop()
+{
+    static uint32_t lastPrint = 0;
+
+    pose.Update();
+
+    if (millis() - lastPrint < 500) return;
+
+    lastPrint = millis();
+
+    Serial.print(pose.X());
+    Serial.print(F(" "));
+    Serial.print(pose.Y());
+    Serial.print(F(" "));
+    Serial.print(pose.Heading() * 180 / PI);
+    Serial.print(F(" "));
+    Serial.print(leftWheel.Velocity());
+    Serial.print(F(" "));
+    Serial.println(rightWheel.Velocity());
+}
@@ -0,0 +1,33 @@
+/*******************************************************************************
+ StaticSensor.ino
+ Reads a sensor whose pin and pulses per revolution are fixed at compile time.
+
+ The sensor ISR of a RotationSensorT type calls its pulse handler directly, and
+ a pin without an external interrupt is a compile error instead of a sensor
+ that never counts.
+*******************************************************************************/
+
+#include <RotationSensorT.h>
+
+typedef RotationSensorT<2, 20> Wheel;
+
+
+void setup()
+{
+    Serial.begin(115200);
+
+    Wheel::Enable();
+}
+
+
+void loop()
+{
+    RotationSensor::CountData data = Wheel::Read();
+
+    Serial.print(data.Count);
+    Serial.print(F(" pulses, "));
+    Serial.print(Wheel::ReadRPM());
+    Serial.println(F(" RPM"));
+
+    delay(500);
+}
@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+"""
+decode_stream.py
+Decodes a RotationSensorStream binary capture to CSV.
+
+The output has the same layout as SampleData_02.csv (Index,Microseconds,Count),
+where Index is the slot of the entry in a pulse history of --history entries.
+Timestamps are extended past the 32 bit wrap and converted to microseconds.
+
+Usage:
+    decode_stream.py capture.bin [--sensor ID] [--history N] > capture.csv
+    decode_stream.py /dev/ttyUSB0 --baud 115200 > capture.csv   (needs pyserial)
+"""
+
+import argparse
+import sys
+
+
+SYNC = b'\xA5\x5A'
+
+
+def read_varint(data, pos):
+    value = 0
+    shift = 0
+
+    while True:
+        if pos >= len(data):
+            raise IndexError('truncated varint')
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if byte < 0x80:
+            return value, pos
+
+
+def parse_frame(data, pos):
+    """Parses the frame that starts at pos (after the sync bytes). Returns the
+    frame as a dict and the position after it, or raises IndexError if the
+    frame is incomplete and ValueError if the checksum does not match."""
+    start = pos
+    sensor_id = data[pos]
+    cpr = data[pos + 1] | (data[pos + 2] << 8)
+    n = data[pos + 3]
+    pos += 4
+    ticks_per_sec, pos = read_varint(data, pos)
+    lost, pos = read_varint(data, pos)
+    count, pos = read_varint(data, pos)
+    time, pos = read_varint(data, pos)
+    times = [time]
+
+    for _ in range(n - 1):
+        delta, pos = read_varint(data, pos)
+        times.append(times[-1] + delta)
+
+    if pos >= len(data):
+        raise IndexError('truncated frame')
+
+    if (sum(data[start:pos]) & 0xFF) != data[pos]:
+        raise ValueError('bad checksum')
+
+    frame = dict(sensor=sensor_id, cpr=cpr, ticks_per_sec=ticks_per_sec,
+                 lost=lost, count=count, times=times)
+    return frame, pos + 1
+
+
+def frames(data):
+    """Yields every valid frame in data, resynchronizing on bad frames."""
+    pos = 0
+
+    while True:
+        pos = data.find(SYNC, pos)
+        if pos < 0:
+            return
+        try:
+            frame, end = parse_frame(data, pos + 2)
+        except IndexError:
+            return
+        except ValueError:
+            pos += 1
+            continue
+        yield frame
+        pos = end
+
+
+def read_input(args):
+    if args.input == '-':
+        return sys.stdin.buffer.read()
+
+    if args.baud:
+        import serial
+        port = serial.Serial(args.input, args.baud)
+        data = bytearray()
+        try:
+            while True:
+                data += port.read(port.in_waiting or 1)
+        except KeyboardInterrupt:
+            return bytes(data)
+
+    with open(args.input, 'rb') as f:
+        return f.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode a RotationSensorStream capture to CSV')
+    parser.add_argument('input', help="capture file, serial port (with --baud) or '-' for stdin")
+    parser.add_argument('--baud', type=int, help='read from a serial port at this baud rate until Ctrl-C')
+    parser.add_argument('--sensor', type=int, help='only decode the frames of this sensor ID')
+    parser.add_argument('--history', type=int, default=32, help='history size used for the Index column')
+    args = parser.parse_args()
+
+    out = sys.stdout
+    out.write('Index,Microseconds,Count\n')
+
+    last = {}      # sensor ID -> (last raw timestamp, extended timestamp)
+    lost = 0
+
+    for frame in frames(read_input(args)):
+        if args.sensor is not None and frame['sensor'] != args.sensor:
+            continue
+
+        lost += frame['lost']
+        prev_raw, extended = last.get(frame['sensor'], (None, 0))
+
+        for i, raw in enumerate(frame['times']):
+            raw &= 0xFFFFFFFF
+            # Extend the 32 bit timestamps across wrap arounds
+            extended = raw if prev_raw is None else extended + ((raw - prev_raw) & 0xFFFFFFFF)
+            prev_raw = raw
+            count = frame['count'] + i
+            micros = extended * 1000000 // frame['ticks_per_sec']
+            out.write('%d,%d,%d\n' % ((count - 1) % args.history, micros, count))
+
+        last[frame['sensor']] = (prev_raw, extended)
+
+    if lost:
+        sys.stderr.write('%d entries lost\n' % lost)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,95 @@
+/*******************************************************************************
+ Arduino.h
+ Host (non-Arduino) stand-in for the parts of the Arduino core used by the
+ RotationSensor library, so the library can be compiled and exercised on a PC.
+
+ micros() returns a simulated clock set with HostSetMicros(), and the
+ functions attached with attachInterrupt() are called by HostInterrupt().
+*******************************************************************************/
+
+#ifndef _HostArduino_h_
+#define _HostArduino_h_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#define NOT_AN_INTERRUPT        -1
+#define EXTERNAL_NUM_INTERRUPTS 2
+
+#define INPUT   0
+#define OUTPUT  1
+#define LOW     0
+#define HIGH    1
+#define CHANGE  1
+#define FALLING 2
+#define RISING  3
+
+#define F(s)    (s)
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+
+// Arduino UNO interrupt pins
+#define digitalPinToInterrupt(p) ((p) == 2 ? 0 : ((p) == 3 ? 1 : NOT_AN_INTERRUPT))
+
+// Templates rather than the AVR core macros, so host code can use the standard
+// library as well
+template<class T, class U> inline auto max(T a, U b) -> decltype(a + b) { return (a > b) ? a : b; }
+template<class T, class U> inline auto min(T a, U b) -> decltype(a + b) { return (a < b) ? a : b; }
+
+typedef uint8_t byte;
+typedef bool    boolean;
+
+unsigned long micros();
+unsigned long millis();
+void pinMode(uint8_t pin, uint8_t mode);
+int  digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+void attachInterrupt(uint8_t irq, void (*isr)(void), int mode);
+void detachInterrupt(uint8_t irq);
+inline void noInterrupts() { }
+inline void interrupts() { }
+
+
+//******************************************************************************
+/// Minimal Print: writes go to the stdio stream passed to the constructor.
+//******************************************************************************
+class Print
+{
+    public: virtual size_t write(uint8_t b) = 0;
+
+    public: virtual size_t write(const uint8_t* buffer, size_t size)
+    {
+        size_t n = 0;
+        while (size--) n += write(*buffer++);
+        return n;
+    }
+
+    public: virtual int availableForWrite() { return 0; }
+
+    public: virtual ~Print() { }
+};
+
+
+/*******************************************************************************
+ Host simulation control
+*******************************************************************************/
+
+//******************************************************************************
+/// Sets the value returned by micros() (and millis()).
+//******************************************************************************
+void HostSetMicros(unsigned long us);
+
+//******************************************************************************
+/// Sets the value returned by digitalRead() for a pin.
+//******************************************************************************
+void HostSetPin(uint8_t pin, int value);
+
+//******************************************************************************
+/// Calls the function attached to an external interrupt, as if its edge had
+/// occurred. Does nothing if no function is attached.
+//******************************************************************************
+void HostInterrupt(uint8_t irq);
+
+#endif
@@ -0,0 +1,128 @@
+/*******************************************************************************
+ CalibrationCheck.cpp
+ Checks RotationSensorCalibration::Learn() on the host.
+
+ A disc with unevenly spaced slots turns at a steady speed, and the learned
+ factors are compared with the inverse of the slot spacing. The same is done
+ with gaps in the pulses the calibration sees: more pulses than the history
+ holds between two calls of Update(), and a reset of the sensor. Prints one line
+ per failure, and exits with the number of failures.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <Arduino.h>
+#include "RotationSensor.h"
+#include "RotationSensorCalibration.h"
+
+
+static const int SENSOR_PIN = 2;
+static const int SENSOR_IRQ = 0;
+static const uint8_t PPR = 8;
+static const uint32_t MEAN_INTERVAL = 5000;
+
+// Relative length of the interval that ends at each count slot, in per mille
+static const uint16_t Spacing[PPR] = { 1000, 1080, 940, 1020, 960, 1050, 990, 960 };
+
+// Learned factors must be within this many Q2.14 units of the exact ones
+static const int32_t TOLERANCE = 16384 / 200;
+
+static int failures = 0;
+
+
+#define CHECK(condition) \
+    do { if (!(condition)) { printf("FAIL line %d: %s\n", __LINE__, #condition); failures++; } } while (0)
+
+
+// The simulated disc, with the count the sensor is expected to be at
+static uint32_t count = 0;
+static uint32_t now = 1000;
+
+
+static void Pulse()
+{
+    count++;
+    now += MEAN_INTERVAL * Spacing[count % PPR] / 1000;
+    HostSetMicros(now);
+    HostInterrupt(SENSOR_IRQ);
+}
+
+
+// Pulses until the calibration is done, calling Update() after every pulse.
+// Before pulse number skipAt, skipCount more pulses are raised without one.
+static bool Run(RotationSensorCalibration& calibration, uint32_t skipAt, uint32_t skipCount)
+{
+    for (uint32_t i = 0; i < 10000; i++)
+    {
+        if (i == skipAt)
+        {
+            for (uint32_t j = 0; j < skipCount; j++) Pulse();
+        }
+
+        Pulse();
+
+        if (!calibration.Update()) return true;
+    }
+
+    return false;
+}
+
+
+static void CheckFactors(RotationSensorCalibration& calibration, int line)
+{
+    for (uint8_t slot = 0; slot < PPR; slot++)
+    {
+        int32_t expected = (int32_t)(16384L * 1000 / Spacing[slot]);
+        int32_t factor   = calibration.Factor(slot);
+
+        if (abs(factor - expected) > TOLERANCE)
+        {
+            printf("FAIL line %d: slot %u factor %ld, expected %ld\n", line, slot, (long)factor, (long)expected);
+            failures++;
+        }
+    }
+}
+
+
+int main()
+{
+    RotationSensor sensor(SENSOR_PIN, PPR);
+    RotationSensorCalibration calibration(sensor);
+
+    HostSetMicros(now);
+    sensor.Enable();
+
+    // Without gaps
+    calibration.Learn(4);
+    CHECK(Run(calibration, 0xFFFFFFFF, 0));
+    CHECK(calibration.Valid());
+    CheckFactors(calibration, __LINE__);
+
+    // Missed pulses in the middle of a revolution, so the slots are measured
+    // an uneven number of times before the gap
+    calibration.Learn(4);
+    CHECK(Run(calibration, 2 * PPR + 3, RotationSensor::HISTORY_SIZE + 5));
+    CHECK(calibration.Valid());
+    CheckFactors(calibration, __LINE__);
+
+    // A reset of the sensor while learning
+    calibration.Learn(4);
+
+    for (uint32_t i = 0; i < PPR + 3; i++)
+    {
+        Pulse();
+        calibration.Update();
+    }
+
+    sensor.Reset();
+    count = 0;
+    CHECK(Run(calibration, 0xFFFFFFFF, 0));
+    CheckFactors(calibration, __LINE__);
+
+    sensor.Disable();
+
+    printf("CalibrationCheck (PPR %u, HISTORY_SIZE %u): %d failures\n", PPR, RotationSensor::HISTORY_SIZE, failures);
+
+    return failures;
+}
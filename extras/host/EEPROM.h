@@ -0,0 +1,25 @@
+/*******************************************************************************
+ EEPROM.h
+ Host mock of the Arduino EEPROM library.
+*******************************************************************************/
+
+#ifndef _EEPROM_h_
+#define _EEPROM_h_
+
+#include <inttypes.h>
+
+
+class EEPROMClass
+{
+    public: uint8_t read(int address) { return _data[address & (SIZE - 1)]; };
+    public: void write(int address, uint8_t value) { _data[address & (SIZE - 1)] = value; };
+    public: void update(int address, uint8_t value) { write(address, value); };
+    public: uint16_t length() { return SIZE; };
+
+    private: static const int SIZE = 1024;
+    private: uint8_t _data[SIZE] = { };
+};
+
+static EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,45 @@
+/*******************************************************************************
+ HostArduino.cpp
+ Host implementation of the Arduino core stand-in (see Arduino.h).
+*******************************************************************************/
+
+#include <Arduino.h>
+
+
+static unsigned long hostMicros;
+static int hostPins[64];
+static void (*hostISRs[EXTERNAL_NUM_INTERRUPTS])(void);
+
+
+unsigned long micros() { return hostMicros; }
+
+unsigned long millis() { return hostMicros / 1000; }
+
+void pinMode(uint8_t, uint8_t) { }
+
+int digitalRead(uint8_t pin) { return hostPins[pin & 63]; }
+
+void digitalWrite(uint8_t pin, uint8_t value) { hostPins[pin & 63] = value; }
+
+
+void attachInterrupt(uint8_t irq, void (*isr)(void), int)
+{
+    if (irq < EXTERNAL_NUM_INTERRUPTS) hostISRs[irq] = isr;
+}
+
+
+void detachInterrupt(uint8_t irq)
+{
+    if (irq < EXTERNAL_NUM_INTERRUPTS) hostISRs[irq] = NULL;
+}
+
+
+void HostSetMicros(unsigned long us) { hostMicros = us; }
+
+void HostSetPin(uint8_t pin, int value) { hostPins[pin & 63] = value; }
+
+
+void HostInterrupt(uint8_t irq)
+{
+    if (irq < EXTERNAL_NUM_INTERRUPTS && hostISRs[irq] != NULL) hostISRs[irq]();
+}
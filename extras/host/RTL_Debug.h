@@ -0,0 +1,15 @@
+/*******************************************************************************
+ RTL_Debug.h
+ Host stand-in for RTL_Debug.
+*******************************************************************************/
+
+#ifndef _HostRTL_Debug_h_
+#define _HostRTL_Debug_h_
+
+#if DEBUG
+#define TRACE(x) x
+#else
+#define TRACE(x)
+#endif
+
+#endif
@@ -0,0 +1,24 @@
+/*******************************************************************************
+ RTL_Stdlib.h
+ Host stand-in for the parts of RTL_Stdlib used by the RotationSensor library.
+ Logger output is discarded.
+*******************************************************************************/
+
+#ifndef _HostRTL_Stdlib_h_
+#define _HostRTL_Stdlib_h_
+
+#include <Arduino.h>
+
+#define DECLARE_CLASSNAME     static const char _classname_[]
+#define DEFINE_CLASSNAME(c)   const char c::_classname_[] = #c
+
+struct HostLogger
+{
+    template<class T> HostLogger& operator<<(const T&) { return *this; }
+};
+
+static const struct HostEndl { } endl = { };
+
+inline HostLogger Logger(const char*, const char* = NULL, const void* = NULL) { return HostLogger(); }
+
+#endif
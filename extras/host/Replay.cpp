@@ -0,0 +1,363 @@
+/*******************************************************************************
+ Replay.cpp
+ Replays captured pulse timestamps through the RotationSensor library on the
+ host and reports the accuracy and cost of each RPM estimator.
+
+ Usage:
+     replay [--ppr N] [--min-interval US] [--max-rpm RPM] [--spike PCT]
+            [--repeat N] file...
+
+ Each file is scanned for pulse timestamps in any of the formats of the sample
+ data in the repository root:
+
+     Index,Time,Count CSV rows (RotationSensor_DebugDump() or
+     decode_stream.py output). The rows of a history dump are in ring buffer
+     order, so they are sorted by count.
+
+     RotationSensor::ReadCount trace lines, which give the times of the last
+     two pulses (startTime and endTime) before the count.
+
+ The pulses are split into runs wherever the count or the time goes backwards
+ or a "Test iteration begin" line appears, and each run is replayed through a
+ freshly reset sensor by setting the mock micros() clock to each timestamp and
+ raising the sensor interrupt. After each pulse every estimator is evaluated
+ and compared to the reference RPM, the average over the last full revolution
+ of consecutive pulses.
+
+ The output is CSV, one line per file and estimator:
+
+     capture,estimator,samples,reference_samples,mean_error_pct,max_error_pct,spikes,ns_per_call
+
+ An estimate is a spike if it is more than --spike percent (default 50) from
+ the reference or, where there is no reference (missing pulses), if it is
+ above --max-rpm (default 5000).
+*******************************************************************************/
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <Arduino.h>
+#include "RotationSensor.h"
+#include "RotationSensorObserver.h"
+
+
+static const int SENSOR_PIN = 2;
+static const int SENSOR_IRQ = 0;
+
+
+struct Pulse
+{
+    uint32_t Count;     // Count just after the pulse, as recorded
+    uint32_t Time;      // Microseconds
+};
+
+typedef std::vector<Pulse> Run;
+
+
+struct Options
+{
+    int      PulsesPerRev = 20;
+    uint16_t MinInterval  = 0;
+    double   MaxRPM       = 5000;
+    double   SpikePercent = 50;
+    int      Repeat       = 16;
+};
+
+
+/*******************************************************************************
+ Estimators
+*******************************************************************************/
+struct Estimator
+{
+    const char* Name;
+    double (*Evaluate)(RotationSensor& sensor);
+};
+
+// The observer of the sensor being replayed, which keeps state across pulses
+static RotationSensorObserver* pObserver = NULL;
+
+// One revolution, as far as the pulse history allows
+static uint8_t RevWindow(RotationSensor& sensor)
+{
+    return min(sensor.Resolution(), RotationSensor::HISTORY_SIZE - 1);
+}
+
+static const Estimator Estimators[] =
+{
+    { "CountData::RPM",  [](RotationSensor& s) -> double { return s.Read().RPM(); } },
+    { "ReadRPM",         [](RotationSensor& s) -> double { return s.ReadRPM(); } },
+    { "ReadRPM(window)", [](RotationSensor& s) -> double { return s.ReadRPM(RevWindow(s)); } },
+    { "ReadRPMAuto",     [](RotationSensor& s) -> double { return s.ReadRPMAuto(); } },
+    { "ReadMilliRPM",    [](RotationSensor& s) -> double { return s.ReadMilliRPM() / 1000.0; } },
+    { "ReadRPM_Q16",     [](RotationSensor& s) -> double { return s.ReadRPM_Q16() / 65536.0; } },
+    { "Observer",        [](RotationSensor&) -> double { return pObserver->ReadRPM(); } },
+};
+
+static const size_t NUM_ESTIMATORS = sizeof(Estimators) / sizeof(Estimators[0]);
+
+
+struct Result
+{
+    uint32_t Samples          = 0;
+    uint32_t ReferenceSamples = 0;
+    double   ErrorSum         = 0;
+    double   MaxError         = 0;
+    uint32_t Spikes           = 0;
+    double   Nanoseconds      = 0;
+    uint32_t Calls            = 0;
+};
+
+
+/*******************************************************************************
+ Capture parsing
+*******************************************************************************/
+static bool ParseUnsigned(const std::string& text, const char* key, uint32_t& value)
+{
+    size_t pos = text.find(key);
+
+    if (pos == std::string::npos) return false;
+
+    value = strtoul(text.c_str() + pos + strlen(key), NULL, 10);
+    return true;
+}
+
+
+static bool ParseRow(const std::string& line, uint32_t& time, uint32_t& count)
+{
+    // Index,Time,Count with optional spaces around the fields
+    unsigned long index, t, c;
+    char tail;
+
+    if (sscanf(line.c_str(), " %lu , %lu , %lu %c", &index, &t, &c, &tail) != 3) return false;
+
+    time  = t;
+    count = c;
+    return true;
+}
+
+
+static void Split(const std::map<uint32_t, uint32_t>& pulses, std::vector<Run>& runs)
+{
+    Run run;
+
+    for (auto& p : pulses)
+    {
+        if (!run.empty() && p.second < run.back().Time)
+        {
+            if (run.size() > 1) runs.push_back(run);
+            run.clear();
+        }
+
+        run.push_back(Pulse { p.first, p.second });
+    }
+
+    if (run.size() > 1) runs.push_back(run);
+}
+
+
+static std::vector<Run> LoadCapture(const char* path, int& pulsesPerRev)
+{
+    std::vector<Run> runs;
+    std::map<uint32_t, uint32_t> pulses;    // Count -> time of the current run
+    std::ifstream in(path);
+    std::string line;
+    uint32_t lastCount = 0;
+
+    if (!in)
+    {
+        fprintf(stderr, "replay: cannot open %s\n", path);
+        return runs;
+    }
+
+    while (std::getline(in, line))
+    {
+        uint32_t count, time, start, ppr;
+
+        if (line.find("Test iteration begin") != std::string::npos)
+        {
+            Split(pulses, runs);
+            pulses.clear();
+            continue;
+        }
+
+        if (ParseUnsigned(line, "pulsesPerRev=", ppr) && ppr > 0) pulsesPerRev = ppr;
+
+        if (ParseRow(line, time, count))
+        {
+            pulses.insert(std::make_pair(count, time));
+        }
+        else if (ParseUnsigned(line, "count=", count) && ParseUnsigned(line, "endTime=", time))
+        {
+            // A count that goes backwards means the sensor was reset
+            if (count < lastCount)
+            {
+                Split(pulses, runs);
+                pulses.clear();
+            }
+
+            lastCount = count;
+            pulses.insert(std::make_pair(count, time));
+
+            if (count > 0 && ParseUnsigned(line, "startTime=", start) && start != time)
+            {
+                pulses.insert(std::make_pair(count - 1, start));
+            }
+        }
+    }
+
+    Split(pulses, runs);
+    return runs;
+}
+
+
+/*******************************************************************************
+ Replay
+*******************************************************************************/
+static double ReferenceRPM(const Run& run, size_t i, int pulsesPerRev)
+{
+    if (i < (size_t)pulsesPerRev) return -1;
+
+    const Pulse& first = run[i - pulsesPerRev];
+    const Pulse& last  = run[i];
+
+    // Only over a full revolution of consecutive pulses
+    if (last.Count - first.Count != (uint32_t)pulsesPerRev || last.Time == first.Time) return -1;
+
+    return 60000000.0 / (last.Time - first.Time);
+}
+
+
+static void Replay(const Run& run, const Options& options, Result results[])
+{
+    RotationSensor sensor(SENSOR_PIN, options.PulsesPerRev, options.MinInterval);
+    RotationSensorObserver observer(sensor);
+
+    pObserver = &observer;
+
+    HostSetMicros(run.front().Time);
+    sensor.Enable();
+
+    for (size_t i = 0; i < run.size(); i++)
+    {
+        HostSetMicros(run[i].Time);
+        HostInterrupt(SENSOR_IRQ);
+
+        if (i == 0) continue;
+
+        double reference = ReferenceRPM(run, i, options.PulsesPerRev);
+
+        for (size_t e = 0; e < NUM_ESTIMATORS; e++)
+        {
+            Result& r = results[e];
+            double estimate = Estimators[e].Evaluate(sensor);
+
+            r.Samples++;
+
+            if (reference > 0)
+            {
+                double error = fabs(estimate - reference) * 100 / reference;
+
+                r.ReferenceSamples++;
+                r.ErrorSum += error;
+                if (error > r.MaxError) r.MaxError = error;
+                if (error > options.SpikePercent) r.Spikes++;
+            }
+            else if (estimate > options.MaxRPM)
+            {
+                r.Spikes++;
+            }
+
+            // Time repeated calls, since a single call is close to the clock resolution
+            volatile double sink;
+            auto start = std::chrono::steady_clock::now();
+
+            for (int n = 0; n < options.Repeat; n++) sink = Estimators[e].Evaluate(sensor);
+
+            auto end = std::chrono::steady_clock::now();
+            (void)sink;
+
+            r.Nanoseconds += std::chrono::duration<double, std::nano>(end - start).count();
+            r.Calls += options.Repeat;
+        }
+    }
+
+    sensor.Disable();
+    pObserver = NULL;
+}
+
+
+static void Usage()
+{
+    fprintf(stderr, "usage: replay [--ppr N] [--min-interval US] [--max-rpm RPM] "
+                    "[--spike PCT] [--repeat N] file...\n");
+    exit(2);
+}
+
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    std::vector<const char*> files;
+    bool pprSet = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+
+        if (arg.compare(0, 2, "--") != 0)
+        {
+            files.push_back(argv[i]);
+            continue;
+        }
+
+        if (i + 1 >= argc) Usage();
+
+        const char* value = argv[++i];
+
+        if      (arg == "--ppr")          { options.PulsesPerRev = atoi(value); pprSet = true; }
+        else if (arg == "--min-interval") options.MinInterval  = atoi(value);
+        else if (arg == "--max-rpm")      options.MaxRPM       = atof(value);
+        else if (arg == "--spike")        options.SpikePercent = atof(value);
+        else if (arg == "--repeat")       options.Repeat       = max(1, atoi(value));
+        else Usage();
+    }
+
+    if (files.empty() || options.PulsesPerRev < 1) Usage();
+
+    printf("capture,estimator,samples,reference_samples,mean_error_pct,max_error_pct,spikes,ns_per_call\n");
+
+    for (const char* path : files)
+    {
+        Options captureOptions = options;
+        Result results[NUM_ESTIMATORS];
+
+        // The pulses per revolution recorded in the capture, unless overridden
+        int ppr = options.PulsesPerRev;
+        std::vector<Run> runs = LoadCapture(path, ppr);
+        if (!pprSet) captureOptions.PulsesPerRev = ppr;
+
+        for (const Run& run : runs) Replay(run, captureOptions, results);
+
+        const char* name = strrchr(path, '/');
+        name = (name != NULL) ? name + 1 : path;
+
+        for (size_t e = 0; e < NUM_ESTIMATORS; e++)
+        {
+            const Result& r = results[e];
+
+            printf("%s,%s,%u,%u,%.2f,%.2f,%u,%.1f\n",
+                   name, Estimators[e].Name, r.Samples, r.ReferenceSamples,
+                   r.ReferenceSamples ? r.ErrorSum / r.ReferenceSamples : 0.0,
+                   r.MaxError, r.Spikes,
+                   r.Calls ? r.Nanoseconds / r.Calls : 0.0);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+/*******************************************************************************
+ TraceCheck.cpp
+ Checks RotationSensor::DrainTrace() on the host, in the configuration it is
+ built with (make check builds it with and without ROTATIONSENSOR_COMPACT).
+
+ Pulses are raised at known times and drained after each one, with nothing
+ new, and after more pulses than the history holds, and the drained entries are
+ compared with the pulses. Prints one line per failure, and exits with the
+ number of failures.
+*******************************************************************************/
+
+#include <chrono>
+#include <stdio.h>
+
+#include <Arduino.h>
+#include "RotationSensor.h"
+
+
+static const int SENSOR_PIN = 2;
+static const int SENSOR_IRQ = 0;
+static const uint8_t N = RotationSensor::HISTORY_SIZE;
+
+static int failures = 0;
+
+
+#define CHECK(condition) \
+    do { if (!(condition)) { printf("FAIL line %d: %s\n", __LINE__, #condition); failures++; } } while (0)
+
+
+// Pulse times spread over more than 16 bits, with intervals below 65536
+static uint32_t PulseTime(uint32_t count)
+{
+    return 1000 + count * 20000 + (count % 7) * 3001;
+}
+
+
+static void Pulse(uint32_t count)
+{
+    HostSetMicros(PulseTime(count));
+    HostInterrupt(SENSOR_IRQ);
+}
+
+
+int main()
+{
+    RotationSensor sensor(SENSOR_PIN, 20);
+    RotationSensor::TraceEntry entries[2 * N];
+    uint32_t lost;
+    uint32_t count = 0;
+
+    HostSetMicros(0);
+    sensor.Enable();
+
+    // Nothing recorded yet
+    CHECK(sensor.DrainTrace(entries, N, &lost) == 0 && lost == 0);
+
+    // One pulse at a time, then an empty drain, which must not walk the count range
+    for (int i = 0; i < 3 * N; i++)
+    {
+        Pulse(count++);
+
+        CHECK(sensor.DrainTrace(entries, N, &lost) == 1 && lost == 0);
+        CHECK(entries[0].Count == count && entries[0].Time == PulseTime(count - 1));
+
+        auto start = std::chrono::steady_clock::now();
+        uint8_t n = sensor.DrainTrace(entries, N, &lost);
+        auto end = std::chrono::steady_clock::now();
+
+        CHECK(n == 0 && lost == 0);
+        CHECK(std::chrono::duration<double>(end - start).count() < 0.01);
+    }
+
+    // A partial drain, then the rest
+    for (int i = 0; i < N; i++) Pulse(count++);
+
+    CHECK(sensor.DrainTrace(entries, N / 2, &lost) == N / 2 && lost == 0);
+    CHECK(entries[0].Count == count - N + 1 && entries[0].Time == PulseTime(count - N));
+    CHECK(sensor.DrainTrace(entries, N, &lost) == N - N / 2 && lost == 0);
+    CHECK(entries[N - N / 2 - 1].Count == count && entries[N - N / 2 - 1].Time == PulseTime(count - 1));
+
+    // More pulses than the history holds: the oldest are lost
+    for (int i = 0; i < 3 * N; i++) Pulse(count++);
+
+    uint8_t n = sensor.DrainTrace(entries, 2 * N, &lost);
+
+    CHECK(n == N && lost == 2 * N);
+
+    for (uint8_t i = 0; i < n; i++)
+    {
+        CHECK(entries[i].Count == count - N + 1 + i && entries[i].Time == PulseTime(count - N + i));
+    }
+
+    CHECK(sensor.DrainTrace(entries, N, &lost) == 0 && lost == 0);
+
+    sensor.Disable();
+
+    printf("TraceCheck (HISTORY_SIZE %u, COMPACT %d): %d failures\n", N, ROTATIONSENSOR_COMPACT, failures);
+
+    return failures;
+}